@@ -0,0 +1,78 @@
+#include "BloomFilter.h"
+#include "murmurhash.h"
+
+using namespace BF;
+
+BloomFilter::BloomFilter(int numKeys, int bitsPerElement)
+{
+    // k = ln(2) * bits per key minimises the false positive rate
+    numProbes = static_cast<int>(bitsPerElement * 0.69);
+    if (numProbes < 1) numProbes = 1;
+    if (numProbes > 30) numProbes = 30;
+
+    size_t numBits = static_cast<size_t>(numKeys < 0 ? 0 : numKeys) * bitsPerElement;
+    if (numBits < 64) numBits = 64;
+    bits.assign((numBits + 7) / 8, 0);
+}
+
+BloomFilter::BloomFilter(const char* data, size_t len)
+{
+    if (len < 2) {
+        // degenerate filter: everything may match
+        bits.assign(1, 0xff);
+        numProbes = 1;
+        return;
+    }
+    bits.assign(reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len - 1);
+    numProbes = static_cast<uint8_t>(data[len - 1]);
+}
+
+uint32_t BloomFilter::hash(int key)
+{
+    uint32_t k = static_cast<uint32_t>(key);
+    uint8_t buf[4] = {static_cast<uint8_t>(k), static_cast<uint8_t>(k >> 8),
+                      static_cast<uint8_t>(k >> 16), static_cast<uint8_t>(k >> 24)};
+    return MurmurHash3_x86_32(buf, 4, 0xbc9f1d34);
+}
+
+void BloomFilter::program(int key)
+{
+    uint32_t h = hash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);
+    const size_t numBits = bits.size() * 8;
+    for (int i = 0; i < numProbes; i++) {
+        size_t pos = h % numBits;
+        bits[pos / 8] |= (1 << (pos % 8));
+        h += delta;
+    }
+}
+
+bool BloomFilter::query(int key) const
+{
+    uint32_t h = hash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);
+    const size_t numBits = bits.size() * 8;
+    for (int i = 0; i < numProbes; i++) {
+        size_t pos = h % numBits;
+        if ((bits[pos / 8] & (1 << (pos % 8))) == 0) return false;
+        h += delta;
+    }
+    return true;
+}
+
+std::string BloomFilter::serialize() const
+{
+    std::string out(bits.begin(), bits.end());
+    out.push_back(static_cast<char>(numProbes));
+    return out;
+}
+
+size_t BloomFilter::getNumBits() const
+{
+    return bits.size() * 8;
+}
+
+int BloomFilter::getNumProbes() const
+{
+    return numProbes;
+}
@@ -0,0 +1,34 @@
+#ifndef _BLOOMFILTER_H_
+#define _BLOOMFILTER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace BF {
+
+// Bloom filter over int keys using double hashing on MurmurHash3.
+// Serialized form: the bit array followed by one byte holding the probe count.
+class BloomFilter
+{
+public:
+    BloomFilter(int numKeys, int bitsPerElement);
+    BloomFilter(const char* data, size_t len);
+
+    void program(int key);
+    bool query(int key) const;
+
+    std::string serialize() const;
+    size_t getNumBits() const;
+    int getNumProbes() const;
+
+private:
+    std::vector<uint8_t> bits;
+    int numProbes;
+
+    static uint32_t hash(int key);
+};
+
+} // namespace BF
+
+#endif /* _BLOOMFILTER_H_ */
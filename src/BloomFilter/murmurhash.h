@@ -0,0 +1,9 @@
+#ifndef _MURMURHASH_H_
+#define _MURMURHASH_H_
+
+#include <cstdint>
+
+// MurmurHash3 (x86, 32-bit) by Austin Appleby, public domain.
+uint32_t MurmurHash3_x86_32(const void* key, int len, uint32_t seed);
+
+#endif /* _MURMURHASH_H_ */
@@ -0,0 +1,59 @@
+#include "Arena.hpp"
+#include <cstdint>
+
+Arena::Arena()
+{
+}
+
+char* Arena::allocate(size_t bytes)
+{
+    if (bytes <= alloc_remaining) {
+        char* result = alloc_ptr;
+        alloc_ptr += bytes;
+        alloc_remaining -= bytes;
+        return result;
+    }
+    return allocate_fallback(bytes);
+}
+
+char* Arena::allocate_aligned(size_t bytes)
+{
+    const size_t align = alignof(void*) > 8 ? alignof(void*) : 8;
+    size_t mod = reinterpret_cast<uintptr_t>(alloc_ptr) & (align - 1);
+    size_t slop = mod == 0 ? 0 : align - mod;
+    if (bytes + slop <= alloc_remaining) {
+        char* result = alloc_ptr + slop;
+        alloc_ptr += bytes + slop;
+        alloc_remaining -= bytes + slop;
+        return result;
+    }
+    // new blocks come from new[] and are always aligned
+    return allocate_fallback(bytes);
+}
+
+size_t Arena::memory_usage() const
+{
+    return usage;
+}
+
+char* Arena::allocate_fallback(size_t bytes)
+{
+    if (bytes > BLOCK_SIZE / 4) {
+        // big objects get a block of their own, so the rest of the current
+        // block is not wasted
+        return allocate_block(bytes);
+    }
+    alloc_ptr = allocate_block(BLOCK_SIZE);
+    alloc_remaining = BLOCK_SIZE;
+    char* result = alloc_ptr;
+    alloc_ptr += bytes;
+    alloc_remaining -= bytes;
+    return result;
+}
+
+char* Arena::allocate_block(size_t bytes)
+{
+    blocks.emplace_back(new char[bytes]);
+    usage += bytes + sizeof(char*);
+    return blocks.back().get();
+}
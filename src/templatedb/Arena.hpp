@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump-pointer allocator for one MemTable. Memory is handed out from large
+// blocks and only given back all at once when the arena is destroyed, so
+// nothing allocated here may need a destructor.
+class Arena
+{
+public:
+    Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    char* allocate(size_t bytes);
+    // aligned for pointers, e.g. skiplist nodes
+    char* allocate_aligned(size_t bytes);
+    // bytes reserved from the system, the exact footprint of the arena
+    size_t memory_usage() const;
+
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    char* alloc_ptr = nullptr;
+    size_t alloc_remaining = 0;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t usage = 0;
+
+    char* allocate_fallback(size_t bytes);
+    char* allocate_block(size_t bytes);
+};
@@ -0,0 +1,103 @@
+#include "BlockCache.hpp"
+
+BlockCache::BlockCache(size_t bytes)
+{
+    set_capacity(bytes);
+}
+
+BlockCache& BlockCache::instance()
+{
+    static BlockCache cache(8 << 20);
+    return cache;
+}
+
+uint64_t BlockCache::new_file_id()
+{
+    static std::atomic<uint64_t> next_id{1};
+    return next_id++;
+}
+
+void BlockCache::set_capacity(size_t bytes)
+{
+    total_capacity = bytes;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.capacity = (bytes + NUM_SHARDS - 1) / NUM_SHARDS;
+        evict(shard);
+    }
+}
+
+size_t BlockCache::capacity() const
+{
+    return total_capacity;
+}
+
+size_t BlockCache::usage() const
+{
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(shard.mutex));
+        total += shard.usage;
+    }
+    return total;
+}
+
+BlockCacheStats& BlockCache::stats()
+{
+    return counters;
+}
+
+BlockCache::Shard& BlockCache::shard_for(const Key &key)
+{
+    return shards[KeyHash()(key) % NUM_SHARDS];
+}
+
+std::shared_ptr<const void> BlockCache::lookup_value(uint64_t file_id, uint64_t offset)
+{
+    Key key{file_id, offset};
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        counters.misses++;
+        return nullptr;
+    }
+    counters.hits++;
+    std::list<Item>& list = shard.lru[it->second->priority];
+    list.splice(list.begin(), list, it->second);
+    return it->second->value;
+}
+
+void BlockCache::insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const void> value,
+    size_t charge, Priority priority)
+{
+    Key key{file_id, offset};
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        // another reader filled it first
+        shard.usage -= it->second->charge;
+        shard.lru[it->second->priority].erase(it->second);
+        shard.index.erase(it);
+    }
+    std::list<Item>& list = shard.lru[priority];
+    list.push_front(Item{key, std::move(value), charge, priority});
+    shard.index[key] = list.begin();
+    shard.usage += charge;
+    evict(shard);
+}
+
+// Drops least recently used entries, LOW before HIGH, until the shard fits.
+// Readers still holding a block keep it alive. Caller holds the shard lock.
+void BlockCache::evict(Shard &shard)
+{
+    while (shard.usage > shard.capacity) {
+        std::list<Item>& list = shard.lru[LOW].empty() ? shard.lru[HIGH] : shard.lru[LOW];
+        if (list.empty()) break;
+        shard.usage -= list.back().charge;
+        shard.index.erase(list.back().key);
+        list.pop_back();
+        counters.evictions++;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct BlockCacheStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
+
+// Process-wide LRU cache of SSTable blocks, keyed by (file id, block offset)
+// and bounded by a byte budget. It is split into shards by key hash, each
+// with its own lock, so concurrent lookups rarely contend. HIGH priority
+// entries (filters) are only evicted once a shard has no LOW ones left.
+// Mapped tables only keep their decoded compressed blocks here: plain
+// blocks are read straight from the mapping, which the page cache holds.
+class BlockCache
+{
+public:
+    enum Priority {
+        LOW,
+        HIGH,
+    };
+
+    static BlockCache& instance();
+    // File ids are never reused, so blocks of a deleted file just age out.
+    static uint64_t new_file_id();
+
+    void set_capacity(size_t bytes);
+    size_t capacity() const;
+    size_t usage() const;
+    BlockCacheStats& stats();
+
+    template<class T>
+    std::shared_ptr<const T> lookup(uint64_t file_id, uint64_t offset)
+    {
+        return std::static_pointer_cast<const T>(lookup_value(file_id, offset));
+    }
+    void insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const void> value,
+        size_t charge, Priority priority = LOW);
+
+private:
+    static const int NUM_SHARDS = 16;
+
+    struct Key {
+        uint64_t file_id;
+        uint64_t offset;
+        bool operator==(const Key& other) const { return file_id == other.file_id && offset == other.offset; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return std::hash<uint64_t>()(k.file_id * 0x9E3779B97F4A7C15ull ^ k.offset); }
+    };
+    struct Item {
+        Key key;
+        std::shared_ptr<const void> value;
+        size_t charge;
+        Priority priority;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<Item> lru[2]; // per priority, most recently used first
+        std::unordered_map<Key, std::list<Item>::iterator, KeyHash> index;
+        size_t usage = 0;
+        size_t capacity = 0;
+    };
+
+    BlockCache(size_t bytes);
+    std::shared_ptr<const void> lookup_value(uint64_t file_id, uint64_t offset);
+    Shard& shard_for(const Key& key);
+    void evict(Shard& shard);
+
+    Shard shards[NUM_SHARDS];
+    std::atomic<size_t> total_capacity;
+    BlockCacheStats counters;
+};
@@ -0,0 +1,275 @@
+#include "BlockCodec.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace table_format;
+
+// bytes the bit unpacker may read past the last packed column, so it can
+// always load a whole 64-bit word
+static const size_t PACK_PADDING = 8;
+
+CompressionStats& compression_stats()
+{
+    static CompressionStats stats;
+    return stats;
+}
+
+static void put_varint64(std::string& dst, uint64_t v)
+{
+    while (v >= 0x80) {
+        dst.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    dst.push_back(static_cast<char>(v));
+}
+
+static const char* get_varint64(const char* p, const char* end, uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint64_t byte = static_cast<unsigned char>(*p++);
+        v |= (byte & 0x7f) << shift;
+        if (byte < 0x80) return p;
+    }
+    return nullptr;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Frame of reference: base u32, bit width u8, then every value minus base
+// in width bits, least significant first.
+static void pack_column(std::string& dst, const std::vector<uint32_t>& values)
+{
+    uint32_t base = UINT32_MAX, top = 0;
+    for (uint32_t v : values) {
+        base = std::min(base, v);
+        top = std::max(top, v);
+    }
+    if (values.empty()) base = 0;
+    uint32_t width = 0;
+    while (width < 32 && ((top - base) >> width) != 0) width++;
+    put_fixed32(dst, base);
+    dst.push_back(static_cast<char>(width));
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+    for (uint32_t v : values) {
+        acc |= static_cast<uint64_t>(v - base) << bits;
+        bits += width;
+        for (; bits >= 8; bits -= 8, acc >>= 8) dst.push_back(static_cast<char>(acc));
+    }
+    if (bits > 0) dst.push_back(static_cast<char>(acc));
+}
+
+// Each value is one unaligned 64-bit load, a shift and a mask with no
+// branch on the data, which the compiler can unroll and vectorize.
+static const char* unpack_column(const char* p, const char* end, size_t n, uint32_t* dst)
+{
+    if (end - p < 5) return nullptr;
+    uint32_t base = get_fixed32(p);
+    uint32_t width = static_cast<unsigned char>(p[4]);
+    p += 5;
+    size_t length = (n * width + 7) / 8;
+    if (width > 32 || static_cast<size_t>(end - p) < length + PACK_PADDING) return nullptr;
+    const uint64_t mask = (uint64_t(1) << width) - 1;
+    for (size_t i = 0; i < n; ++i) {
+        size_t bit = i * width;
+        dst[i] = base + static_cast<uint32_t>((get_fixed64(p + (bit >> 3)) >> (bit & 7)) & mask);
+    }
+    return p + length;
+}
+
+bool compress_block(Compression codec, const char* block, size_t n, std::string& out)
+{
+    if (codec == NO_COMPRESSION || n < 4) return false;
+    uint32_t count = get_fixed32(block + n - 4);
+    const char* offsets = block + n - 4 - 4 * static_cast<size_t>(count);
+    std::vector<EntryView> views(count);
+    uint16_t max_dims = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        decode_view(block + get_fixed32(offsets + 4 * i), views[i]);
+        max_dims = std::max(max_dims, views[i].dims);
+    }
+
+    out.clear();
+    out.push_back(static_cast<char>(codec));
+    if (codec == DELTA_VARINT) {
+        uint32_t last_key = 0;
+        uint64_t last_seq = 0;
+        for (const EntryView& v : views) {
+            put_varint64(out, static_cast<uint32_t>(v.key) - last_key);
+            put_varint64(out, zigzag(static_cast<int64_t>(v.seq - last_seq)));
+            put_varint64(out, (static_cast<uint64_t>(v.dims) << 1) | (v.tomb ? 1 : 0));
+            for (uint16_t i = 0; i < v.dims; ++i) put_varint64(out, zigzag(v.item(i)));
+            last_key = static_cast<uint32_t>(v.key);
+            last_seq = v.seq;
+        }
+        return out.size() < n;
+    }
+
+    // BIT_PACKED: first key, packed key deltas, the low and high halves of
+    // the seqs packed, packed (dims, tomb) flags, then one packed column per
+    // value position
+    std::vector<uint32_t> column;
+    put_fixed32(out, count > 0 ? static_cast<uint32_t>(views[0].key) : 0);
+    for (uint32_t i = 1; i < count; ++i)
+        column.push_back(static_cast<uint32_t>(views[i].key) - static_cast<uint32_t>(views[i - 1].key));
+    pack_column(out, column);
+    for (int half = 0; half < 2; ++half) {
+        column.clear();
+        for (const EntryView& v : views) column.push_back(static_cast<uint32_t>(v.seq >> (32 * half)));
+        pack_column(out, column);
+    }
+    column.clear();
+    for (const EntryView& v : views) column.push_back((static_cast<uint32_t>(v.dims) << 1) | (v.tomb ? 1 : 0));
+    pack_column(out, column);
+    for (uint16_t d = 0; d < max_dims; ++d) {
+        column.clear();
+        for (const EntryView& v : views)
+            if (v.dims > d) column.push_back(static_cast<uint32_t>(v.item(d)));
+        pack_column(out, column);
+    }
+    out.append(PACK_PADDING, '\0');
+    return out.size() < n;
+}
+
+static void store32(char* p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+static void store64(char* p, uint64_t v)
+{
+    store32(p, static_cast<uint32_t>(v));
+    store32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+// Entry header of the plain layout at p, returns where its items go.
+static char* store_header(char* p, uint32_t key, uint64_t seq, bool tomb, uint16_t dims)
+{
+    store32(p, key);
+    store64(p + 4, seq);
+    p[12] = tomb ? 1 : 0;
+    p[13] = static_cast<char>(dims);
+    p[14] = static_cast<char>(dims >> 8);
+    return p + ENTRY_HEADER_SIZE;
+}
+
+// The decoders write the plain layout in place: entries from the front of
+// out, each one's offset into the array that ends just before the count.
+// They keep their cursors in locals, since every byte they store could
+// otherwise alias them.
+static bool decode_delta_varint(const char* p, const char* end, uint32_t count,
+    char* data, char* offsets)
+{
+    char* w = data;
+    uint32_t key = 0;
+    uint64_t seq = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t key_delta, seq_delta, flags;
+        if (!(p = get_varint64(p, end, key_delta)) || !(p = get_varint64(p, end, seq_delta))
+            || !(p = get_varint64(p, end, flags)) || (flags >> 1) > UINT16_MAX) return false;
+        key += static_cast<uint32_t>(key_delta);
+        seq += static_cast<uint64_t>(unzigzag(seq_delta));
+        uint16_t dims = static_cast<uint16_t>(flags >> 1);
+        if (static_cast<size_t>(offsets - w) < ENTRY_HEADER_SIZE + 4 * static_cast<size_t>(dims)) return false;
+        store32(offsets + 4 * static_cast<size_t>(i), static_cast<uint32_t>(w - data));
+        w = store_header(w, key, seq, flags & 1, dims);
+        for (uint16_t d = 0; d < dims; ++d, w += 4) {
+            uint64_t item;
+            if (!(p = get_varint64(p, end, item))) return false;
+            store32(w, static_cast<uint32_t>(unzigzag(item)));
+        }
+    }
+    return p == end && w == offsets;
+}
+
+static bool decode_bit_packed(const char* p, const char* end, uint32_t count,
+    char* data, char* offsets)
+{
+    if (count == 0 || end - p < 4) return false;
+    std::vector<uint32_t> keys(count), seq_low(count), seq_high(count), flags(count);
+    keys[0] = get_fixed32(p);
+    if (!(p = unpack_column(p + 4, end, count - 1, keys.data() + 1))
+        || !(p = unpack_column(p, end, count, seq_low.data()))
+        || !(p = unpack_column(p, end, count, seq_high.data()))
+        || !(p = unpack_column(p, end, count, flags.data()))) return false;
+    for (uint32_t i = 1; i < count; ++i) keys[i] += keys[i - 1];
+
+    // column d holds item d of every entry with more than d items
+    size_t items = 0;
+    bool uniform = true;
+    std::vector<uint32_t> column_size;
+    for (uint32_t f : flags) {
+        uint32_t dims = f >> 1;
+        if (dims > UINT16_MAX) return false;
+        if (column_size.size() < dims) column_size.resize(dims, 0);
+        for (uint32_t d = 0; d < dims; ++d) column_size[d]++;
+        items += dims;
+        uniform = uniform && f == flags[0];
+    }
+    if (count * ENTRY_HEADER_SIZE + 4 * items != static_cast<size_t>(offsets - data)) return false;
+    std::vector<uint32_t> values(items);
+    std::vector<size_t> column_pos(column_size.size());
+    size_t start = 0;
+    for (size_t d = 0; d < column_size.size(); ++d) {
+        column_pos[d] = start;
+        if (!(p = unpack_column(p, end, column_size[d], values.data() + start))) return false;
+        start += column_size[d];
+    }
+    if (static_cast<size_t>(end - p) != PACK_PADDING) return false;
+
+    char* w = data;
+    const uint32_t* key = keys.data();
+    const uint32_t* low = seq_low.data();
+    const uint32_t* high = seq_high.data();
+    const uint32_t* value = values.data();
+    if (uniform) {
+        // every column holds one item per entry, so no cursors are needed
+        uint16_t dims = static_cast<uint16_t>(flags[0] >> 1);
+        bool tomb = flags[0] & 1;
+        for (uint32_t i = 0; i < count; ++i) {
+            store32(offsets + 4 * static_cast<size_t>(i), static_cast<uint32_t>(w - data));
+            w = store_header(w, key[i], (static_cast<uint64_t>(high[i]) << 32) | low[i], tomb, dims);
+            for (uint16_t d = 0; d < dims; ++d, w += 4) store32(w, value[d * static_cast<size_t>(count) + i]);
+        }
+        return true;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t dims = static_cast<uint16_t>(flags[i] >> 1);
+        store32(offsets + 4 * static_cast<size_t>(i), static_cast<uint32_t>(w - data));
+        w = store_header(w, key[i], (static_cast<uint64_t>(high[i]) << 32) | low[i], flags[i] & 1, dims);
+        for (uint16_t d = 0; d < dims; ++d, w += 4) store32(w, value[column_pos[d]++]);
+    }
+    return true;
+}
+
+bool decompress_block(const char* data, size_t n, uint32_t count, uint32_t raw_size, std::string& out)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (n < 1 || raw_size < 4 + 4 * static_cast<size_t>(count)) return false;
+    out.resize(raw_size);
+    char* offsets = &out[0] + raw_size - 4 - 4 * static_cast<size_t>(count);
+    store32(&out[0] + raw_size - 4, count);
+    bool ok = false;
+    if (data[0] == DELTA_VARINT) {
+        ok = decode_delta_varint(data + 1, data + n, count, &out[0], offsets);
+    } else if (data[0] == BIT_PACKED) {
+        ok = decode_bit_packed(data + 1, data + n, count, &out[0], offsets);
+    }
+    if (!ok) return false;
+
+    CompressionStats& stats = compression_stats();
+    stats.blocks_decoded++;
+    stats.decode_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return true;
+}
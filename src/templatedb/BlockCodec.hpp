@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "TableFormat.hpp"
+
+// Process-wide block compression counters. raw / stored is the compression
+// ratio of the blocks written so far, decode_nanos / blocks_decoded the
+// average cost of turning one back into the plain layout.
+struct CompressionStats {
+    std::atomic<uint64_t> raw_bytes{0};    // plain size of the blocks written
+    std::atomic<uint64_t> stored_bytes{0}; // what they took on disk
+    std::atomic<uint64_t> blocks_decoded{0};
+    std::atomic<uint64_t> decode_nanos{0};
+};
+
+CompressionStats& compression_stats();
+
+// Encodes a plain data block (entries, offset array, count) with codec into
+// out, codec byte first. Returns false when that would not save space, and
+// the block is then stored as is.
+bool compress_block(table_format::Compression codec, const char* block, size_t n, std::string& out);
+
+// Decodes a block written by compress_block back into exactly raw_size
+// bytes of the plain layout holding count entries. Returns false when the
+// stored bytes do not decode to that.
+bool decompress_block(const char* data, size_t n, uint32_t count, uint32_t raw_size, std::string& out);
@@ -0,0 +1,112 @@
+#include "CompactionPolicy.hpp"
+#include <algorithm>
+#include <climits>
+
+std::unique_ptr<CompactionPolicy> CompactionPolicy::create(Kind kind)
+{
+    switch (kind) {
+    case LEVELING:
+        return std::make_unique<LevelingPolicy>();
+    case LAZY_LEVELING:
+        return std::make_unique<LazyLevelingPolicy>();
+    default:
+        return std::make_unique<TieringPolicy>();
+    }
+}
+
+static bool overlaps(const FileMeta& f, int min, int max)
+{
+    return f.min <= max && f.max >= min;
+}
+
+// true when no two files of the level share a key
+static bool is_sorted_run(const std::vector<std::shared_ptr<FileMeta>>& files)
+{
+    std::vector<std::pair<int, int>> ranges;
+    for (const auto& f : files) ranges.push_back({f->min, f->max});
+    std::sort(ranges.begin(), ranges.end());
+    for (size_t i = 1; i < ranges.size(); ++i)
+        if (ranges[i].first <= ranges[i - 1].second) return false;
+    return true;
+}
+
+Compaction CompactionPolicy::tier(const Version &version, int level)
+{
+    Compaction c;
+    c.level = level;
+    c.output_level = level + 1;
+    c.inputs = version.levels.at(level);
+    return c;
+}
+
+Compaction CompactionPolicy::merge_into_next(const Version &version, int level,
+    std::vector<std::shared_ptr<FileMeta>> inputs, uint64_t target_file_size)
+{
+    Compaction c;
+    c.level = level;
+    c.output_level = level + 1;
+    c.inputs = std::move(inputs);
+    c.leveled = true;
+    c.target_file_size = target_file_size;
+    if (c.output_level > version.max_level()) return c;
+
+    int min = INT_MAX, max = INT_MIN;
+    for (const auto& f : c.inputs) {
+        min = std::min(min, f->min);
+        max = std::max(max, f->max);
+    }
+    // the output goes after every file of output_level, so one left behind
+    // that shares a key with it would be shadowed. Runs written by another
+    // policy overlap each other, so the range grows until no file is left
+    // that it reaches; in a sorted run the first pass already gets them all.
+    const auto& files = version.levels[c.output_level];
+    std::vector<bool> taken(files.size(), false);
+    for (bool grown = true; grown;) {
+        grown = false;
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (taken[i] || !overlaps(*files[i], min, max)) continue;
+            taken[i] = grown = true;
+            min = std::min(min, files[i]->min);
+            max = std::max(max, files[i]->max);
+        }
+    }
+    for (size_t i = 0; i < files.size(); ++i)
+        if (taken[i]) c.next_inputs.push_back(files[i]);
+    return c;
+}
+
+Compaction TieringPolicy::plan(const Version &version, int level, uint64_t)
+{
+    return tier(version, level);
+}
+
+Compaction LevelingPolicy::plan(const Version &version, int level, uint64_t target_file_size)
+{
+    const auto& files = version.levels.at(level);
+    if (files.empty()) return Compaction();
+    // level 0, and levels written by another policy, hold overlapping runs:
+    // moving just one file down would let an older one shadow it
+    if (level == 0 || !is_sorted_run(files))
+        return merge_into_next(version, level, files, target_file_size);
+
+    // otherwise take the files round-robin by key, so every part of the
+    // key space gets pushed down in turn
+    if (compact_pointer.size() <= static_cast<size_t>(level))
+        compact_pointer.resize(level + 1, INT_MIN);
+    std::shared_ptr<FileMeta> next, first;
+    for (const auto& f : files) {
+        if (!first || f->min < first->min) first = f;
+        if (f->min > compact_pointer[level] && (!next || f->min < next->min)) next = f;
+    }
+    if (!next) next = first;
+    compact_pointer[level] = next->max;
+    return merge_into_next(version, level, {next}, target_file_size);
+}
+
+Compaction LazyLevelingPolicy::plan(const Version &version, int level, uint64_t target_file_size)
+{
+    // the last level, and whatever flows into it, is leveled
+    if (level + 1 >= version.max_level())
+        return last_level.plan(version, level, target_file_size);
+    return tier(version, level);
+}
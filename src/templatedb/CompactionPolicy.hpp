@@ -0,0 +1,73 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "Version.hpp"
+
+// One unit of compaction work: merge inputs (files of level) together with
+// next_inputs (files of output_level their key range reaches) into
+// output_level.
+struct Compaction {
+    int level = -1;
+    int output_level = 0;
+    std::vector<std::shared_ptr<FileMeta>> inputs;
+    std::vector<std::shared_ptr<FileMeta>> next_inputs;
+    // the output joins the sorted run of output_level: it replaces
+    // next_inputs, is split into files of at most target_file_size, and
+    // output_level must not be compacted meanwhile. Otherwise the output is
+    // one new run appended to output_level.
+    bool leveled = false;
+    uint64_t target_file_size = 0; // level size units, 0 means one file
+
+    bool empty() const { return inputs.empty(); }
+};
+
+// Decides what compacting an over-full level means. The DB picks the level
+// (highest size/target score) and runs the merge; the policy chooses which
+// files go in and how the output is laid out. Called under the DB mutex.
+class CompactionPolicy
+{
+public:
+    enum Kind {
+        TIERING,       // every level holds runs; a full level is merged into one run of the next
+        LEVELING,      // every level below 0 is one sorted run; files merge into the overlapping ones below
+        LAZY_LEVELING, // tiering on upper levels, leveling into the last level
+    };
+
+    static std::unique_ptr<CompactionPolicy> create(Kind kind);
+    virtual ~CompactionPolicy() = default;
+    virtual Kind kind() const = 0;
+    virtual Compaction plan(const Version& version, int level, uint64_t target_file_size) = 0;
+
+protected:
+    static Compaction tier(const Version& version, int level);
+    static Compaction merge_into_next(const Version& version, int level,
+        std::vector<std::shared_ptr<FileMeta>> inputs, uint64_t target_file_size);
+};
+
+class TieringPolicy : public CompactionPolicy
+{
+public:
+    Kind kind() const override { return TIERING; }
+    Compaction plan(const Version& version, int level, uint64_t target_file_size) override;
+};
+
+class LevelingPolicy : public CompactionPolicy
+{
+public:
+    Kind kind() const override { return LEVELING; }
+    Compaction plan(const Version& version, int level, uint64_t target_file_size) override;
+
+private:
+    std::vector<int> compact_pointer; // per level, max key of the file compacted last
+};
+
+class LazyLevelingPolicy : public CompactionPolicy
+{
+public:
+    Kind kind() const override { return LAZY_LEVELING; }
+    Compaction plan(const Version& version, int level, uint64_t target_file_size) override;
+
+private:
+    LevelingPolicy last_level;
+};
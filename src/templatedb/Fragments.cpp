@@ -0,0 +1,134 @@
+#include "Fragments.hpp"
+#include <algorithm>
+#include <set>
+
+using templatedb::Fragment;
+using templatedb::RangeTomb;
+
+std::vector<Fragment> build_fragments(const std::vector<RangeTomb>& tombs)
+{
+    // (position, is start, seq); ends sort before starts at the same position
+    struct Bound {
+        int pos;
+        bool start;
+        uint64_t seq;
+    };
+    std::vector<Bound> bounds;
+    bounds.reserve(tombs.size() * 2);
+    for (const auto& t : tombs) {
+        if (t.start >= t.end) continue;
+        bounds.push_back(Bound{t.start, true, t.seq});
+        bounds.push_back(Bound{t.end, false, t.seq});
+    }
+    std::sort(bounds.begin(), bounds.end(), [](const Bound& a, const Bound& b) {
+        if (a.pos != b.pos) return a.pos < b.pos;
+        return a.start < b.start;
+    });
+
+    std::vector<Fragment> fragments;
+    std::multiset<uint64_t> active;
+    for (size_t i = 0; i < bounds.size();) {
+        int pos = bounds[i].pos;
+        for (; i < bounds.size() && bounds[i].pos == pos; ++i) {
+            if (bounds[i].start) {
+                active.insert(bounds[i].seq);
+            } else {
+                active.erase(active.find(bounds[i].seq));
+            }
+        }
+        if (active.empty() || i == bounds.size()) continue;
+        uint64_t max_seq = *active.rbegin();
+        int next = bounds[i].pos;
+        if (!fragments.empty() && fragments.back().end == pos && fragments.back().max_seq == max_seq) {
+            fragments.back().end = next;
+        } else {
+            fragments.push_back(Fragment{pos, next, max_seq});
+        }
+    }
+    return fragments;
+}
+
+const Fragment* find_fragment(const std::vector<Fragment>& fragments, int key)
+{
+    auto it = std::upper_bound(fragments.begin(), fragments.end(), key,
+        [](int k, const Fragment& f) { return k < f.start; });
+    if (it == fragments.begin()) return nullptr;
+    --it;
+    return key < it->end ? &*it : nullptr;
+}
+
+bool is_key_covered_by_fragment(const std::vector<Fragment>& fragments, int key, uint64_t seq)
+{
+    const Fragment* f = find_fragment(fragments, key);
+    return f != nullptr && f->max_seq > seq;
+}
+
+bool is_key_covered_at(const Fragment& frag, const std::vector<RangeTomb>& tombs,
+    int key, uint64_t from, uint64_t snapshot)
+{
+    if (frag.max_seq < from) return false;
+    if (frag.max_seq < snapshot) return true;
+    for (const auto& t : tombs)
+        if (t.start <= key && key < t.end && t.seq >= from && t.seq < snapshot) return true;
+    return false;
+}
+
+// Cuts the fragment spanning at, if any, into [start, at) and [at, end).
+void FragmentMap::split(int at)
+{
+    auto it = map.upper_bound(at);
+    if (it == map.begin()) return;
+    --it;
+    Fragment& f = it->second;
+    if (f.start == at || f.end <= at) return;
+    Fragment right{at, f.end, f.max_seq};
+    f.end = at;
+    map.emplace(at, right);
+}
+
+void FragmentMap::add(const RangeTomb& t)
+{
+    if (t.start >= t.end) return;
+    split(t.start);
+    split(t.end);
+    // raise the fragments inside [start, end) and fill the gaps between them
+    int pos = t.start;
+    auto it = map.lower_bound(t.start);
+    while (pos < t.end) {
+        if (it != map.end() && it->first == pos) {
+            it->second.max_seq = std::max(it->second.max_seq, t.seq);
+            pos = it->second.end;
+            ++it;
+        } else {
+            int gap_end = (it != map.end() && it->first < t.end) ? it->first : t.end;
+            map.emplace_hint(it, pos, Fragment{pos, gap_end, t.seq});
+            pos = gap_end;
+        }
+    }
+}
+
+const Fragment* FragmentMap::find(int key) const
+{
+    auto it = map.upper_bound(key);
+    if (it == map.begin()) return nullptr;
+    --it;
+    return key < it->second.end ? &it->second : nullptr;
+}
+
+std::vector<Fragment> FragmentMap::fragments() const
+{
+    std::vector<Fragment> result;
+    result.reserve(map.size());
+    for (const auto& kv : map) result.push_back(kv.second);
+    return result;
+}
+
+bool FragmentMap::empty() const
+{
+    return map.empty();
+}
+
+void FragmentMap::clear()
+{
+    map.clear();
+}
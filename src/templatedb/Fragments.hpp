@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "struct.hpp"
+
+// Splits possibly overlapping range tombstones into sorted, disjoint
+// fragments, each carrying the newest seq that covers it. Sweeps the sorted
+// bounds once with the active seqs in a multiset, O(T log T).
+std::vector<templatedb::Fragment> build_fragments(const std::vector<templatedb::RangeTomb>& tombs);
+
+// The fragment holding key, or nullptr.
+const templatedb::Fragment* find_fragment(const std::vector<templatedb::Fragment>& fragments, int key);
+
+// True when a range tombstone newer than seq covers key.
+bool is_key_covered_by_fragment(const std::vector<templatedb::Fragment>& fragments, int key, uint64_t seq);
+
+// For a reader at snapshot, which only sees tombstones below it: true when a
+// tombstone with seq in [from, snapshot) covers key. frag is the fragment
+// holding key; only when its newest seq is too new do the raw tombs decide.
+bool is_key_covered_at(const templatedb::Fragment& frag, const std::vector<templatedb::RangeTomb>& tombs,
+    int key, uint64_t from, uint64_t snapshot);
+
+// Fragments kept disjoint as range tombstones arrive, so the MemTable can
+// answer a point lookup in O(log F) instead of checking every tombstone.
+class FragmentMap
+{
+public:
+    void add(const templatedb::RangeTomb& t);
+    const templatedb::Fragment* find(int key) const;
+    std::vector<templatedb::Fragment> fragments() const;
+    bool empty() const;
+    void clear();
+
+private:
+    std::map<int, templatedb::Fragment> map; // by start
+    void split(int at);
+};
@@ -0,0 +1,98 @@
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const char* new_base, size_t new_length)
+{
+    base = new_base;
+    length = new_length;
+}
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string &filePath)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive, the descriptor is not needed anymore
+    ::close(fd);
+    if (addr == MAP_FAILED) return nullptr;
+
+    return std::unique_ptr<MappedFile>(new MappedFile(static_cast<const char*>(addr), st.st_size));
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<char*>(base), length);
+}
+
+const char* MappedFile::data() const
+{
+    return base;
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
+
+void MappedFile::advise(Access access)
+{
+    madvise(const_cast<char*>(base), length, access == SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+void MappedFile::will_need(size_t offset, size_t n)
+{
+    if (offset >= length) return;
+    // madvise wants a page-aligned start
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    madvise(const_cast<char*>(base) + start, std::min(offset + n, length) - start, MADV_WILLNEED);
+}
+
+RandomAccessFile::RandomAccessFile(int new_fd, uint64_t new_length)
+{
+    fd = new_fd;
+    length = new_length;
+}
+
+std::unique_ptr<RandomAccessFile> RandomAccessFile::open(const std::string &filePath)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<RandomAccessFile>(new RandomAccessFile(fd, st.st_size));
+}
+
+RandomAccessFile::~RandomAccessFile()
+{
+    ::close(fd);
+}
+
+bool RandomAccessFile::read(uint64_t offset, size_t n, char* dst) const
+{
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = pread(fd, dst + done, n - done, offset + done);
+        if (r <= 0) return false;
+        done += r;
+    }
+    return true;
+}
+
+uint64_t RandomAccessFile::size() const
+{
+    return length;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only mmap of a whole file. Owned by one SSTable, unmapped on destroy.
+class MappedFile
+{
+public:
+    enum Access {
+        RANDOM,
+        SEQUENTIAL,
+    };
+
+    static std::unique_ptr<MappedFile> open(const std::string& filePath);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+    void advise(Access access);
+    // starts reading [offset, offset + n) in, whatever the advice
+    void will_need(size_t offset, size_t n);
+
+private:
+    MappedFile(const char* base, size_t length);
+    const char* base;
+    size_t length;
+};
+
+// File read with pread, so concurrent readers need no shared file position.
+class RandomAccessFile
+{
+public:
+    static std::unique_ptr<RandomAccessFile> open(const std::string& filePath);
+    ~RandomAccessFile();
+    RandomAccessFile(const RandomAccessFile&) = delete;
+    RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+    bool read(uint64_t offset, size_t n, char* dst) const;
+    uint64_t size() const;
+
+private:
+    RandomAccessFile(int fd, uint64_t length);
+    int fd;
+    uint64_t length;
+};
@@ -1,11 +1,12 @@
 #include "MemTable.hpp"
+#include "TableBuilder.hpp"
 #include <algorithm>
-#include <unordered_set>
-#include <iomanip>
-#include <sstream>
+#include <cstring>
 
 MemTable::MemTable()
 {
+    arena = std::make_unique<Arena>();
+    entries = std::make_unique<Index>(EntryOrder(), arena.get());
     size = 0;
     min = INT32_MAX;
     max = INT32_MIN;
@@ -14,8 +15,15 @@ MemTable::MemTable()
 MemTable::MemTable(const std::vector<templatedb::Entry> &new_entries, const std::vector<templatedb::RangeTomb> &new_tombs, 
     int new_min, int new_max, uint64_t new_size, uint64_t new_seq_start)
 {
-    entries = new_entries;
+    arena = std::make_unique<Arena>();
+    entries = std::make_unique<Index>(EntryOrder(), arena.get());
+    for (const auto& e : new_entries) {
+        insert(e);
+        if (e.tomb) deletions++;
+    }
     tombs = new_tombs;
+    deletions += tombs.size();
+    for (const auto& t : tombs) fragments.add(t);
     min = new_min;
     max = new_max;
     size = new_size;
@@ -23,143 +31,114 @@ MemTable::MemTable(const std::vector<templatedb::Entry> &new_entries, const std:
 
 }
 
-bool MemTable::flush(const std::string &filePath)
+bool MemTable::flush(const std::string &filePath, int bits_per_key, table_format::Compression compression)
 {
-    sort_entries();
     sort_tombs();
-    return save(filePath);
+    return save(filePath, bits_per_key, compression);
 }
 
-bool MemTable::save(const std::string &filePath)
+bool MemTable::save(const std::string &filePath, int bits_per_key, table_format::Compression compression)
 {
-    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) return false;
-
-    // header
-    file << size << "\n";
-    file << tombs.size() << "\n";
-    file << min << "\n";
-    file << max << "\n";
-    file << seq_start << "\n";
-
-    std::streampos offset_pos = file.tellp();
-
-    // Step1: entry_offset, tomb_offset, key_index_offset
-    for (int i = 0; i < 3; ++i) {
-        file << "          \n";  // 10 spaces + \n
-    }
-
-    // Step 2: entries
-    std::vector<std::pair<int, std::streampos>> key_offsets;
-    std::unordered_set<int> seen;
-    std::streampos entry_offset = file.tellp();
-
-    for (const auto& e : entries) {
-        std::streampos pos = file.tellp();
-        if (!seen.count(e.key)) {
-            key_offsets.push_back({e.key, pos});
-            seen.insert(e.key);
-        }
-        file << e.seq << " " << (e.tomb ? 1 : 0) << " " << e.key;
-        for (int v : e.val.items) file << " " << v;
-        file << "\n";
-    }
-
-    // Step 3: tombstones
-    std::streampos tomb_offset = file.tellp();
-    for (const auto& t : tombs) {
-        file << t.seq << " " << t.start << " " << t.end << "\n";
-    }
-
-    // Step 4: key-offset table
-    std::streampos key_index_offset = file.tellp();
-    for (const auto& [key, pos] : key_offsets) {
-        file << key << " " << static_cast<uint64_t>(pos) << "\n";
-    }
-
-    // Step 5: write back
-    file.seekp(offset_pos);
-    file << std::setw(10) << std::left << entry_offset << "\n"
-         << std::setw(10) << std::left << tomb_offset << "\n"
-         << std::setw(10) << std::left << key_index_offset << "\n";
-
-    file.close();
-    return true;
+    TableBuilder builder(filePath, bits_per_key, compression);
+    if (!builder.ok()) return false;
+
+    // entries are kept sorted and already encoded, tombstones must already be sorted
+    Iterator it(this);
+    for (it.seek_to_first(); it.valid(); it.next()) builder.add(it.view());
+    for (const auto& t : tombs) builder.add_tomb(t);
+    return builder.finish();
 }
 
 
-std::optional<templatedb::Value> MemTable::get(int key)
+std::optional<templatedb::Value> MemTable::get(int key, uint64_t snapshot)
 {
-    if (key > max || key < min){
+    // a snapshot taken before the first write sees nothing
+    if (key > max || key < min || snapshot == 0){
         return std::nullopt;
     }
-    templatedb::Entry* best = nullptr;
-    for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry){
-        if (entry->key == key) {
-            if (!best || entry->seq > best->seq) {
-                best = &(*entry);
-            }
-        }
+    // the first entry at or after (key, snapshot - 1) is the newest version
+    // of key the reader can see
+    Iterator it(this);
+    it.seek(key, snapshot - 1);
+    std::optional<table_format::EntryView> best;
+    if (it.valid() && it.view().key == key) {
+        best = it.view();
     }
-    for (const auto& t : tombs) {
-        if (key >= t.start && key < t.end) {
-            if (!best){
-                return templatedb::Value(false); 
-            } else if (t.seq > best->seq){
-                return templatedb::Value(false); 
-            }
-        }
+    std::shared_lock<std::shared_mutex> lock(tomb_mutex);
+    const templatedb::Fragment* frag = fragments.find(key);
+    if (frag && (!best || frag->max_seq > best->seq)
+        && is_key_covered_at(*frag, tombs, key, best ? best->seq + 1 : 0, snapshot)) {
+        return templatedb::Value(false);
     }
     if (!best) return std::nullopt;
-    if (best->tomb) return templatedb::Value(false);
-    return best->val;
+    return best->value();
 }
 
 void MemTable::add(int key, const templatedb::Value &val, uint64_t seq)
 {
     size++;
-    entries.push_back(templatedb::Entry{false, seq, key, val});
+    insert(templatedb::Entry{false, seq, key, val});
     if (seq_start == -1)
         seq_start = seq;
-    sorted = false;
-    min = std::min(min, key);
-    max = std::max(max, key);
+    seq_end = std::max(seq_end, seq);
+    min = std::min(min.load(), key);
+    max = std::max(max.load(), key);
 }
 
 void MemTable::point_delete(int key, uint64_t seq)
 {
     size++;
-    entries.push_back(templatedb::Entry{true, seq, key, templatedb::Value(false)});
+    deletions++;
+    insert(templatedb::Entry{true, seq, key, templatedb::Value(false)});
     if (seq_start == -1)
         seq_start = seq;
-    sorted = false;
-    min = std::min(min, key);
-    max = std::max(max, key);
+    seq_end = std::max(seq_end, seq);
+    min = std::min(min.load(), key);
+    max = std::max(max.load(), key);
 }
 
 void MemTable::range_delete(int range_min, int range_max, uint64_t seq)
 {
     size++;
-    tombs.push_back(templatedb::RangeTomb{range_min, range_max, seq});
+    deletions++;
+    {
+        std::unique_lock<std::shared_mutex> lock(tomb_mutex);
+        tombs.push_back(templatedb::RangeTomb{range_min, range_max, seq});
+        fragments.add(tombs.back());
+    }
     if (seq_start == -1)
         seq_start = seq;
+    seq_end = std::max(seq_end, seq);
     range_sorted = false;
-    min = std::min(min, range_min);
-    max = std::max(max, range_max);
+    min = std::min(min.load(), range_min);
+    max = std::max(max.load(), range_max);
 }
 
 bool MemTable::hasRangeDelete()
 {
+    std::shared_lock<std::shared_mutex> lock(tomb_mutex);
     return !tombs.empty();
 }
 
-static bool entry_cmp(const templatedb::Entry& a, const templatedb::Entry& b) {
-    if (a.key != b.key) return a.key < b.key;          
-    return a.seq > b.seq;                              
+std::vector<templatedb::Entry> MemTable::getEntries() const
+{
+    std::vector<templatedb::Entry> result;
+    result.reserve(entries->size());
+    Iterator it(this);
+    for (it.seek_to_first(); it.valid(); it.next()) result.push_back(it.view().to_entry());
+    return result;
+}
+
+std::vector<templatedb::RangeTomb> MemTable::getRangeTomb() const
+{
+    std::shared_lock<std::shared_mutex> lock(tomb_mutex);
+    return tombs;
 }
 
-void MemTable::sort_entries() {
-    std::sort(entries.begin(), entries.end(), entry_cmp); 
+std::vector<templatedb::Fragment> MemTable::getFragments() const
+{
+    std::shared_lock<std::shared_mutex> lock(tomb_mutex);
+    return fragments.fragments();
 }
 
 
@@ -169,43 +148,111 @@ static bool tomb_cmp(const templatedb::RangeTomb& a, const templatedb::RangeTomb
 }
 
 void MemTable::sort_tombs(){
+    std::unique_lock<std::shared_mutex> lock(tomb_mutex);
     std::sort(tombs.begin(), tombs.end(), tomb_cmp);
 }
 
 
 void MemTable::clear(){
     size = 0;
+    deletions = 0;
     min = INT32_MAX;
     max = INT32_MIN;
     seq_start = -1;
-    entries.clear();
+    seq_end = 0;
+    // the old arena goes with all its blocks at once
+    entries.reset();
+    arena = std::make_unique<Arena>();
+    entries = std::make_unique<Index>(EntryOrder(), arena.get());
+    iter = entries->iterator();
     tombs.clear();
-    sorted_entries.clear();
+    fragments.clear();
     sorted_tombs.clear();
-    iter_index = 0;
     range_iter_index = 0;
-    sorted = false;
     range_sorted = false;
 }
 
+MemTable::Iterator MemTable::iterator() const
+{
+    return Iterator(this);
+}
+
+size_t MemTable::memory_usage() const
+{
+    return arena->memory_usage() + tombs.capacity() * sizeof(templatedb::RangeTomb);
+}
+
+// Encodes e into the arena and indexes it.
+void MemTable::insert(const templatedb::Entry &e)
+{
+    scratch.clear();
+    table_format::encode_entry(scratch, e);
+    char* data = arena->allocate(scratch.size());
+    std::memcpy(data, scratch.data(), scratch.size());
+    entries->insert(data);
+}
+
+MemTable::Iterator::Iterator(const MemTable *mem)
+{
+    it = mem->entries->iterator();
+}
+
+void MemTable::Iterator::seek_to_first()
+{
+    it.seek_to_first();
+}
+
+void MemTable::Iterator::seek(int key)
+{
+    seek(key, UINT64_MAX);
+}
+
+void MemTable::Iterator::seek(int key, uint64_t seq)
+{
+    // only the key and seq of the target are compared
+    char target[table_format::ENTRY_HEADER_SIZE] = {};
+    std::string header;
+    table_format::put_fixed32(header, static_cast<uint32_t>(key));
+    table_format::put_fixed64(header, seq);
+    std::memcpy(target, header.data(), header.size());
+    it.seek(target);
+}
+
+bool MemTable::Iterator::valid() const
+{
+    return it.valid();
+}
+
+table_format::EntryView MemTable::Iterator::view() const
+{
+    table_format::EntryView v;
+    table_format::decode_view(it.value(), v);
+    return v;
+}
+
+void MemTable::Iterator::next()
+{
+    it.next();
+}
+
 std::optional<templatedb::Entry> MemTable::next(){
     if (!has_next()){
         return std::nullopt;
     }
-    return sorted_entries[iter_index++];
+    table_format::EntryView v;
+    table_format::decode_view(iter.value(), v);
+    iter.next();
+    return v.to_entry();
 }
 
 bool MemTable::has_next(){
-    return iter_index < sorted_entries.size();
+    return iter.valid();
 }
 
 void MemTable::reset_iterator(){
-    iter_index = 0;
-    if (!sorted){
-        sorted_entries = entries;
-        std::sort(sorted_entries.begin(), sorted_entries.end(), entry_cmp);
-        sorted = true;
-    }
+    // the skiplist is always sorted, just walk it
+    iter = entries->iterator();
+    iter.seek_to_first();
 }
 
 std::optional<templatedb::RangeTomb> MemTable::range_tombs_next(){
@@ -6,33 +6,88 @@
 #include <iostream>
 #include <fstream>
 
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
 #include "struct.hpp"
+#include "Arena.hpp"
+#include "SkipList.hpp"
+#include "Fragments.hpp"
+#include "TableFormat.hpp"
+
+// (key asc, seq desc) over entries encoded in the arena (SSTable entry
+// layout): the newest version of a key comes first
+struct EntryOrder {
+    bool operator()(const char* a, const char* b) const {
+        int ka = static_cast<int>(table_format::get_fixed32(a));
+        int kb = static_cast<int>(table_format::get_fixed32(b));
+        if (ka != kb) return ka < kb;
+        return table_format::get_fixed64(a + 4) > table_format::get_fixed64(b + 4);
+    }
+};
 
+// Entries are encoded once into an Arena and indexed by a skiplist of
+// pointers, so a MemTable is a few large blocks that are freed together
+// when it is dropped after its flush. One writer at a time (the DB's write
+// group leader) may add to it while any number of readers look it up.
 class MemTable
 {
 public:
+    typedef SkipList<const char*, EntryOrder> Index;
+
+    // Entries as views into the arena, valid for the life of the MemTable.
+    // Independent of next()/reset_iterator(), so several readers can walk it.
+    class Iterator
+    {
+    public:
+        Iterator() {}
+        explicit Iterator(const MemTable* mem);
+        void seek_to_first();
+        // newest version of the first key >= key
+        void seek(int key);
+        // first entry at or after (key, seq): the newest version of key
+        // not newer than seq, or the next key
+        void seek(int key, uint64_t seq);
+        bool valid() const;
+        table_format::EntryView view() const;
+        void next();
+
+    private:
+        Index::Iterator it;
+    };
+
     uint64_t size = 0;
+    uint64_t deletions = 0; // point and range deletes, counted in size too
     uint64_t seq_start = -1;
-    int min = 0, max;
+    uint64_t seq_end = 0; // newest seq written
+    std::atomic<int> min{0}, max{0}; // read by lookups while the writer extends them
     MemTable();
     MemTable(const std::vector<templatedb::Entry>& entries,
         const std::vector<templatedb::RangeTomb>& tombs,
         int min, int max,
         uint64_t size, uint64_t seq_start);
-    bool flush(const std::string& filePath);
-    bool save(const std::string& filePath);
+    bool flush(const std::string& filePath, int bits_per_key = 10,
+        table_format::Compression compression = table_format::NO_COMPRESSION);
+    bool save(const std::string& filePath, int bits_per_key = 10,
+        table_format::Compression compression = table_format::NO_COMPRESSION);
 
-    std::optional<templatedb::Value> get(int key);
+    // newest version of key below snapshot (everything by default)
+    std::optional<templatedb::Value> get(int key, uint64_t snapshot = UINT64_MAX);
     void add(int key, const templatedb::Value& val, uint64_t seq);
     void point_delete(int key, uint64_t seq);
     void range_delete(int min, int max, uint64_t seq);
-    const std::vector<templatedb::Entry>& getEntries() const;
-    const std::vector<templatedb::RangeTomb>& getRangeTomb() const;
+    std::vector<templatedb::Entry> getEntries() const;
+    std::vector<templatedb::RangeTomb> getRangeTomb() const;
+    std::vector<templatedb::Fragment> getFragments() const;
     bool hasRangeDelete();
 
-    void sort_entries();
     void sort_tombs();
     void clear();
+    // arena blocks plus range tombstones, in bytes
+    size_t memory_usage() const;
+    Iterator iterator() const;
     std::optional<templatedb::Entry> next();
     bool has_next();
     void reset_iterator();
@@ -41,13 +96,18 @@ public:
     void reset_range_iterator();
 
 private:
-    std::vector<templatedb::Entry> entries;
+    std::unique_ptr<Arena> arena;
+    std::unique_ptr<Index> entries;
+    Index::Iterator iter;
+    std::string scratch;
+    // range deletes are rare, so readers of the tombstones share a lock
+    // instead of the skiplist's lock-free scheme
+    mutable std::shared_mutex tomb_mutex;
     std::vector<templatedb::RangeTomb> tombs;
-    std::vector<templatedb::Entry> sorted_entries;
+    FragmentMap fragments; // the same tombstones, for lookups
     std::vector<templatedb::RangeTomb> sorted_tombs;
-    int iter_index = 0;
     int range_iter_index = 0;
-    bool sorted = false;
     bool range_sorted = false;
-    
+
+    void insert(const templatedb::Entry& e);
 };
@@ -0,0 +1,97 @@
+#include "MergingIterator.hpp"
+
+TableSource::TableSource(SSTable *table, bool readahead)
+    : cursor(table)
+{
+    cursor.set_readahead(readahead);
+}
+
+void TableSource::seek_to_first()
+{
+    cursor.seek_to_first();
+    next();
+}
+
+void TableSource::seek(int key)
+{
+    cursor.seek(key);
+    next();
+}
+
+bool TableSource::valid() const
+{
+    return has_current;
+}
+
+const table_format::EntryView& TableSource::view() const
+{
+    return current;
+}
+
+void TableSource::next()
+{
+    std::optional<table_format::EntryView> v;
+    if (cursor.has_next()) v = cursor.next_view();
+    has_current = v.has_value();
+    if (has_current) current = v.value();
+}
+
+MergingIterator::MergingIterator(const std::vector<SSTable*> &tables)
+    : heap(Order{&sources})
+{
+    for (SSTable* table : tables) sources.push_back(std::make_unique<TableSource>(table));
+}
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<EntrySource>> new_sources)
+    : heap(Order{&sources})
+{
+    sources = std::move(new_sources);
+}
+
+void MergingIterator::seek_to_first()
+{
+    for (auto& source : sources) source->seek_to_first();
+    rebuild();
+}
+
+void MergingIterator::seek(int key)
+{
+    for (auto& source : sources) source->seek(key);
+    rebuild();
+}
+
+bool MergingIterator::valid() const
+{
+    return has_top;
+}
+
+const table_format::EntryView& MergingIterator::view() const
+{
+    return sources[top]->view();
+}
+
+void MergingIterator::next()
+{
+    // the current view may point into the source's buffer, so the source is
+    // only advanced once the caller is done with it
+    sources[top]->next();
+    if (sources[top]->valid()) heap.push(top);
+    pop_top();
+}
+
+void MergingIterator::rebuild()
+{
+    heap = std::priority_queue<size_t, std::vector<size_t>, Order>(Order{&sources});
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i]->valid()) heap.push(i);
+    }
+    pop_top();
+}
+
+void MergingIterator::pop_top()
+{
+    has_top = !heap.empty();
+    if (!has_top) return;
+    top = heap.top();
+    heap.pop();
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <queue>
+
+#include "SSTable.hpp"
+
+// One sorted input of a MergingIterator, in (key asc, seq desc) order.
+class EntrySource
+{
+public:
+    virtual ~EntrySource() = default;
+    virtual void seek_to_first() = 0;
+    // first entry whose key is >= key
+    virtual void seek(int key) = 0;
+    virtual bool valid() const = 0;
+    // stays valid until the next call to next() or a seek
+    virtual const table_format::EntryView& view() const = 0;
+    virtual void next() = 0;
+};
+
+// Walks one SSTable through a cursor of its own, so the table may be shared.
+// The table is owned by the caller.
+class TableSource : public EntrySource
+{
+public:
+    explicit TableSource(SSTable* table, bool readahead = false);
+    void seek_to_first() override;
+    void seek(int key) override;
+    bool valid() const override;
+    const table_format::EntryView& view() const override;
+    void next() override;
+
+private:
+    SSTable::Cursor cursor;
+    table_format::EntryView current;
+    bool has_current = false;
+};
+
+// Heap merge over sorted sources, yielding every version in (key asc,
+// seq desc) order. Only one entry per source is held at a time, so memory
+// does not grow with the size of the inputs.
+class MergingIterator
+{
+public:
+    // the tables are owned by the caller and must outlive the iterator
+    explicit MergingIterator(const std::vector<SSTable*>& tables);
+    explicit MergingIterator(std::vector<std::unique_ptr<EntrySource>> sources);
+    // the heap order points back at sources
+    MergingIterator(const MergingIterator&) = delete;
+    MergingIterator& operator=(const MergingIterator&) = delete;
+
+    void seek_to_first();
+    void seek(int key);
+    bool valid() const;
+    // stays valid until the next call to next() or a seek
+    const table_format::EntryView& view() const;
+    void next();
+
+private:
+    struct Order {
+        const std::vector<std::unique_ptr<EntrySource>>* sources;
+        bool operator()(size_t a, size_t b) const {
+            const table_format::EntryView& x = (*sources)[a]->view();
+            const table_format::EntryView& y = (*sources)[b]->view();
+            if (x.key != y.key) return x.key > y.key; // min-heap
+            return x.seq < y.seq;                     // newest version first
+        }
+    };
+
+    std::vector<std::unique_ptr<EntrySource>> sources;
+    // indexes of the valid sources other than top
+    std::priority_queue<size_t, std::vector<size_t>, Order> heap;
+    size_t top = 0;
+    bool has_top = false;
+
+    void rebuild();
+    void pop_top();
+};
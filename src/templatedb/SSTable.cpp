@@ -1,8 +1,10 @@
 #include "SSTable.hpp"
-#include <unordered_set>
+#include "TableBuilder.hpp"
+#include "Fragments.hpp"
+#include "BlockCodec.hpp"
+#include <sstream>
 #include <set>
 #include <algorithm>
-#include <iomanip>
 
 SSTable::SSTable()
 {
@@ -42,16 +44,155 @@ void SSTable::load_key_offset()
 }
 
 
-static std::vector<templatedb::Fragment> build_fragments(const std::vector<templatedb::RangeTomb>& tombs);
-
-SSTable::SSTable(const std::string &filePath)
+SSTable::SSTable(const std::string &filePath, bool use_mmap, uint64_t block_cache_id)
 {
     path = filePath;
-    infile.open(filePath);
+    cache_id = block_cache_id;
+    if (use_mmap) {
+        // map once, every later read is a pointer into the mapping
+        mapping = MappedFile::open(filePath);
+        if (mapping) {
+            mapping->advise(MappedFile::RANDOM);
+            if (open_binary()) return;
+            mapping.reset();
+            if (corrupt) return;
+        }
+    }
+
+    file = RandomAccessFile::open(filePath);
+    if (!file) {
+        std::cerr << "Failed to open SSTable file: " << filePath << std::endl;
+        return;
+    }
+    if (open_binary()) return;
+
+    file.reset();
+    // a binary file that failed its checks is not a text one either
+    if (corrupt) return;
+    infile.open(filePath, std::ios::binary);
     if (!infile.is_open()) {
         std::cerr << "Failed to open SSTable file: " << filePath << std::endl;
         return;
     }
+    open_legacy();
+}
+
+// Reads the footer, meta index, properties, key index and block index of a
+// binary SSTable. Returns false when the file has no binary footer, or sets
+// corrupt when it has one but its sections do not fit.
+bool SSTable::open_binary()
+{
+    using namespace table_format;
+    uint64_t file_size;
+    if (mapping) {
+        file_size = mapping->size();
+    } else {
+        file_size = file->size();
+    }
+    if (file_size < FOOTER_SIZE) return false;
+
+    std::string footer_buf;
+    const char* footer = read_ptr(file_size - FOOTER_SIZE, FOOTER_SIZE, footer_buf);
+    if (!footer) return false;
+    if (get_fixed64(footer + 16) != MAGIC) return false;
+    uint32_t version = get_fixed32(footer + 12);
+    if (version > VERSION) {
+        std::cerr << "Unsupported SSTable version " << version << ": " << path << std::endl;
+        return false;
+    }
+
+    // counts inside a section are checked against its length before they are
+    // trusted, so a corrupt file is rejected instead of read past its end
+    auto reject = [this](const char* what) {
+        std::cerr << "Corrupt SSTable " << what << ": " << path << std::endl;
+        // left like a table that failed to open: nothing to read
+        corrupt = true;
+        blocks.clear();
+        bloomFilter.reset();
+        size = tombs_size = 0;
+        tomb_section_size = fragment_section_size = filter_size = 0;
+        return false;
+    };
+    std::string meta_buf;
+    uint32_t meta_size = get_fixed32(footer + 8);
+    const char* meta = read_ptr(get_fixed64(footer), meta_size, meta_buf);
+    if (!meta) return false;
+    if (meta_size < 4) return reject("meta index");
+    uint32_t sections = get_fixed32(meta);
+    if (4 + META_ENTRY_SIZE * static_cast<uint64_t>(sections) > meta_size) return reject("meta index");
+    std::string data;
+    for (uint32_t i = 0; i < sections; ++i) {
+        const char* m = meta + 4 + META_ENTRY_SIZE * i;
+        uint32_t type = get_fixed32(m);
+        uint64_t offset = get_fixed64(m + 4);
+        uint64_t length = get_fixed64(m + 12);
+
+        if (type == KEY_INDEX) {
+            // per-key index of version 1 tables, the block index is enough
+            continue;
+        }
+        if (type == TOMBSTONES) {
+            // loaded lazily by load_tombs()
+            tomb_offset = static_cast<std::streamoff>(offset);
+            tomb_section_size = length;
+            continue;
+        }
+        if (type == FRAGMENTS) {
+            // loaded lazily by load_fragments()
+            fragment_offset = offset;
+            fragment_section_size = length;
+            continue;
+        }
+        if (type == FILTER && !mapping) {
+            // loaded lazily through the block cache by filter()
+            filter_offset = offset;
+            filter_size = length;
+            continue;
+        }
+        const char* p = read_ptr(offset, length, data);
+        if (!p) return false;
+        if (type == FILTER) {
+            bloomFilter = std::make_unique<BF::BloomFilter>(p, length);
+        } else if (type == PROPERTIES) {
+            if (length < PROPERTIES_SIZE) return reject("properties");
+            size = get_fixed64(p);
+            tombs_size = get_fixed64(p + 8);
+            min = static_cast<int>(get_fixed32(p + 16));
+            max = static_cast<int>(get_fixed32(p + 20));
+            seq_start = get_fixed64(p + 24);
+        } else if (type == BLOCK_INDEX) {
+            if (length < 4) return reject("block index");
+            uint32_t n = get_fixed32(p);
+            size_t handle_size = version >= 3 ? BLOCK_HANDLE_SIZE : BLOCK_HANDLE_SIZE_V2;
+            if (4 + handle_size * static_cast<uint64_t>(n) > length) return reject("block index");
+            blocks.reserve(n);
+            for (uint32_t k = 0; k < n; ++k) {
+                const char* q = p + 4 + handle_size * k;
+                uint32_t stored = get_fixed32(q + 16);
+                blocks.push_back(BlockHandle{static_cast<int>(get_fixed32(q)), static_cast<int>(get_fixed32(q + 4)),
+                    get_fixed64(q + 8), stored, get_fixed32(q + 20), version >= 3 ? get_fixed32(q + 24) : stored});
+            }
+        }
+    }
+
+    is_range_delete = (tombs_size > 0);
+    read_offset = true;
+    // a mapped table reads plain blocks from the page cache, but keeps the
+    // decoded copies of compressed ones in the block cache like pread does
+    bool compressed = std::any_of(blocks.begin(), blocks.end(),
+        [](const BlockHandle& b) { return b.size != b.raw_size; });
+    if (mapping && !compressed) cache_id = 0;
+    else if (cache_id == 0) cache_id = BlockCache::new_file_id();
+    return true;
+}
+
+// Text format written before the binary layout, kept so old SSTables/
+// directories can still be read and compacted into the binary format.
+void SSTable::open_legacy()
+{
+    legacy = true;
+    infile.clear();
+    infile.seekg(0);
 
     std::string line;
     std::getline(infile, line); size = std::stoull(line);
@@ -64,6 +205,7 @@ SSTable::SSTable(const std::string &filePath)
     std::getline(infile, line); key_index_offset = std::stoull(line);
 
     is_range_delete = (tombs_size > 0);
+    read_offset = true;
     infile.seekg(key_index_offset);
     while (std::getline(infile, line)) {
         std::istringstream ss(line);
@@ -75,70 +217,130 @@ SSTable::SSTable(const std::string &filePath)
     }
 }
 
-bool SSTable::save(const std::string& filePath)
+bool SSTable::read_at(uint64_t offset, size_t n, std::string &out)
 {
-    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) return false;
-
-    // Step 1: header
-    file << size << "\n";
-    file << tombs.size() << "\n";
-    file << min << "\n";
-    file << max << "\n";
-    file << seq_start << "\n";
-
-    std::streampos offset_pos = file.tellp();
+    // a bad length from a corrupt index must not turn into a huge allocation
+    if (!file || offset > file->size() || n > file->size() - offset) return false;
+    out.resize(n);
+    return file->read(offset, n, &out[0]);
+}
 
-    // entry offset, tomb offset, key index offset
-    for (int i = 0; i < 3; ++i) {
-        file << "          \n";  // 10 spaces + \n
+// Returns a pointer to n bytes at offset: straight into the mapping when the
+// file is mapped, otherwise read into scratch.
+const char* SSTable::read_ptr(uint64_t offset, size_t n, std::string &scratch)
+{
+    if (mapping) {
+        if (offset > mapping->size() || n > mapping->size() - offset) return nullptr;
+        return mapping->data() + offset;
     }
+    if (!read_at(offset, n, scratch)) return nullptr;
+    return scratch.data();
+}
 
-    // Step 2: entries
-    std::vector<std::pair<int, std::streampos>> key_offsets;
-    std::unordered_set<int> seen;
-    std::streampos entry_offset = file.tellp();
-
-    for (const auto& e : entries) {
-        std::streampos pos = file.tellp();
-        if (!seen.count(e.key)) {
-            key_offsets.push_back({e.key, pos});
-            seen.insert(e.key);
-        }
-        file << e.seq << " " << (e.tomb ? 1 : 0) << " " << e.key;
-        for (int v : e.val.items) file << " " << v;
-        file << "\n";
+// Plain layout of data block idx: straight from the mapping or the read
+// when it is stored as is, otherwise decoded into scratch.
+const char* SSTable::block_ptr(size_t idx, std::string &scratch)
+{
+    const table_format::BlockHandle& h = blocks[idx];
+    if (h.size == h.raw_size) return read_ptr(h.offset, h.size, scratch);
+    std::string stored;
+    const char* p = read_ptr(h.offset, h.size, stored);
+    if (!p || !decompress_block(p, h.size, h.count, h.raw_size, scratch)) {
+        std::cerr << "Corrupt block at " << h.offset << " in " << path << std::endl;
+        return nullptr;
     }
+    return scratch.data();
+}
 
-    // Step 3: tombstones
-    std::streampos tomb_offset = file.tellp();
-    for (const auto& t : tombs) {
-        file << t.seq << " " << t.start << " " << t.end << "\n";
+// Data block idx through the block cache in pread mode or when it has to be
+// decoded, otherwise straight from the mapping. Kept in block, so
+// consecutive lookups in the same block read it once.
+const char* SSTable::load_block(size_t idx, BlockRef &block)
+{
+    if (block.idx == idx) return block.data;
+    block.idx = idx;
+    if (cache_id == 0 || (mapping && blocks[idx].size == blocks[idx].raw_size)) {
+        block.data = block_ptr(idx, block.scratch);
+    } else {
+        block.pinned = cached_block(idx);
+        block.data = block.pinned ? block.pinned->data() : nullptr;
     }
+    return block.data;
+}
 
-    // Step 4: key-offset table
-    std::streampos key_index_offset = file.tellp();
-    for (const auto& [key, pos] : key_offsets) {
-        file << key << " " << static_cast<uint64_t>(pos) << "\n";
-    }
+// Data block idx from the block cache, read (and decoded) and inserted on a
+// miss. Plain blocks of mapped files are already served by the page cache.
+std::shared_ptr<const std::string> SSTable::cached_block(size_t idx)
+{
+    BlockCache& cache = BlockCache::instance();
+    const table_format::BlockHandle& h = blocks[idx];
+    std::shared_ptr<const std::string> block = cache.lookup<std::string>(cache_id, h.offset);
+    if (block) return block;
+    // cached decoded, so a hit never pays for decompression again
+    auto loaded = std::make_shared<std::string>();
+    const char* data = block_ptr(idx, *loaded);
+    if (!data) return nullptr;
+    if (data != loaded->data()) loaded->assign(data, h.raw_size);
+    cache.insert(cache_id, h.offset, loaded, loaded->size());
+    return loaded;
+}
 
-    // write back to the offset
-    file.seekp(offset_pos);
-    file << std::setw(10) << std::left << entry_offset << "\n"
-         << std::setw(10) << std::left << tomb_offset << "\n"
-         << std::setw(10) << std::left << key_index_offset << "\n";
+// Filter of a pread-mode table, kept in the block cache at high priority so
+// data blocks are evicted first.
+std::shared_ptr<const BF::BloomFilter> SSTable::filter()
+{
+    if (filter_size == 0) return nullptr;
+    BlockCache& cache = BlockCache::instance();
+    std::shared_ptr<const BF::BloomFilter> f = cache.lookup<BF::BloomFilter>(cache_id, filter_offset);
+    if (f) return f;
+    std::string buf;
+    if (!read_at(filter_offset, filter_size, buf)) return nullptr;
+    auto loaded = std::make_shared<const BF::BloomFilter>(buf.data(), buf.size());
+    cache.insert(cache_id, filter_offset, loaded, filter_size, BlockCache::HIGH);
+    return loaded;
+}
 
-    file.close();
-    return true;
+void SSTable::advise(MappedFile::Access access)
+{
+    if (mapping) mapping->advise(access);
+}
+
+bool SSTable::save(const std::string& filePath)
+{
+    TableBuilder builder(filePath);
+    if (!builder.ok()) return false;
+    for (const auto& e : entries) builder.add(e);
+    for (const auto& t : tombs) builder.add_tomb(t);
+    return builder.finish();
 }
 
 void SSTable::load_tombs() {
     if (!is_range_delete || !tombs.empty()){
         return;
     }
+    tombs = read_tombs();
+}
+
+// The raw range tombstones as stored, in file order.
+std::vector<templatedb::RangeTomb> SSTable::read_tombs()
+{
+    std::vector<templatedb::RangeTomb> result;
+    if (!legacy) {
+        std::string buf;
+        const char* data = read_ptr(static_cast<uint64_t>(tomb_offset), tomb_section_size, buf);
+        if (!data) return result;
+        uint32_t n = table_format::get_fixed32(data);
+        result.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            const char* p = data + 4 + table_format::TOMB_SIZE * i;
+            result.push_back(templatedb::RangeTomb{static_cast<int>(table_format::get_fixed32(p)),
+                static_cast<int>(table_format::get_fixed32(p + 4)), table_format::get_fixed64(p + 8)});
+        }
+        return result;
+    }
 
     std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) return;
+    if (!file.is_open()) return result;
 
     file.seekg(tomb_offset);
 
@@ -148,57 +350,168 @@ void SSTable::load_tombs() {
         uint64_t seq;
         int start, end;
         ss >> seq >> start >> end;
-        tombs.push_back(templatedb::RangeTomb{start, end, seq});
+        result.push_back(templatedb::RangeTomb{start, end, seq});
     }
+    return result;
 }
 
-std::optional<templatedb::Value> SSTable::get(int key)
+std::optional<templatedb::Value> SSTable::get(int key, uint64_t snapshot)
 {
     if (key > max || key < min){
         return std::nullopt;
     }
-    // binary search
-    if (!read_offset){
-        load_key_offset();
+
+    bool filtered_out = false;
+    std::shared_ptr<const BF::BloomFilter> pread_filter = filter();
+    const BF::BloomFilter* bf = bloomFilter ? bloomFilter.get() : pread_filter.get();
+    if (bf) {
+        FilterStats& stats = filter_stats();
+        stats.checks++;
+        if (!bf->query(key)) {
+            // key is not in this file, only its range tombstones can still matter
+            stats.negatives++;
+            filtered_out = true;
+        }
     }
-    int left = 0, right = key_offsets.size() - 1;
-    int found_idx = -1;
 
-    while (left <= right) {
-        int mid = (left + right) / 2;
-        if (key_offsets[mid].first == key) {
-            found_idx = mid;
-            break;
-        } else if (key_offsets[mid].first < key) {
-            left = mid + 1;
-        } else {
-            right = mid - 1;
+    load_fragments();
+    if (legacy) {
+        std::optional<templatedb::Value> val = filtered_out ? std::nullopt : get_legacy(key, snapshot);
+        if (val.has_value()) return val;
+    } else if (!filtered_out) {
+        // the first block whose last key is >= key holds the newest version
+        auto it = std::lower_bound(blocks.begin(), blocks.end(), key,
+            [](const table_format::BlockHandle& b, int k) { return b.last_key < k; });
+        table_format::EntryView v;
+        BlockRef block;
+        if (find_version(it - blocks.begin(), key, snapshot, v, block)) {
+            if (is_range_delete && is_key_covered_at(key, v.seq + 1, snapshot)) return templatedb::Value(false);
+            // the only copy on the lookup path
+            return v.value();
         }
+        if (bf) filter_stats().false_positives++;
+    }
+    if (is_range_delete && is_key_covered_at(key, 0, snapshot)){
+        return templatedb::Value(false);
     }
 
-    if (is_range_delete && fragments.empty()){
-        load_tombs();
-        fragments = build_fragments(tombs);
+    return std::nullopt;
+}
+
+// Looks up keys (sorted ascending, distinct) in one walk over the block
+// index: the filter is fetched once, and keys landing in the same block share
+// its read. out[i] is left empty when keys[i] is not in this file.
+void SSTable::multi_get(const std::vector<int>& keys, std::vector<std::optional<templatedb::Value>>& out,
+    uint64_t snapshot)
+{
+    out.assign(keys.size(), std::nullopt);
+    if (legacy) {
+        for (size_t i = 0; i < keys.size(); ++i) out[i] = get(keys[i], snapshot);
+        return;
     }
-    if (found_idx != -1){
-        if(!infile.is_open()){
-            infile.open(path);
+    std::shared_ptr<const BF::BloomFilter> pread_filter = filter();
+    const BF::BloomFilter* bf = bloomFilter ? bloomFilter.get() : pread_filter.get();
+    load_fragments();
+
+    size_t b = 0;
+    BlockRef block;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int key = keys[i];
+        if (key < min || key > max) continue;
+        bool filtered_out = false;
+        if (bf) {
+            FilterStats& stats = filter_stats();
+            stats.checks++;
+            if (!bf->query(key)) {
+                stats.negatives++;
+                filtered_out = true;
+            }
         }
-        infile.clear();
-        infile.seekg(key_offsets[found_idx].second);
-        std::string line;
-        while (std::getline(infile, line)) {
-            templatedb::Entry e = parse_line(line);
-            if (e.key != key) break;
-
-            if (is_range_delete && is_key_covered_by_fragment(key, e.seq)) return templatedb::Value(false);
-            return e.val;
+        if (!filtered_out) {
+            while (b < blocks.size() && blocks[b].last_key < key) ++b;
+            table_format::EntryView v;
+            if (find_version(b, key, snapshot, v, block)) {
+                if (is_range_delete && is_key_covered_at(key, v.seq + 1, snapshot))
+                    out[i] = templatedb::Value(false);
+                else
+                    out[i] = v.value();
+                continue;
+            }
+            if (bf) filter_stats().false_positives++;
         }
+        if (is_range_delete && is_key_covered_at(key, 0, snapshot))
+            out[i] = templatedb::Value(false);
     }
-    if (is_range_delete&&is_key_covered_by_fragment(key, 0)){
-        return templatedb::Value(false);
+}
+
+// Newest version of key below snapshot, starting at block idx (the first
+// block whose last key is >= key) with a binary search over its entry
+// offsets. Older versions of a key may spill into the following blocks, so
+// the walk continues there. block keeps the bytes v points to alive.
+bool SSTable::find_version(size_t idx, int key, uint64_t snapshot, table_format::EntryView &v, BlockRef &block)
+{
+    using namespace table_format;
+    if (idx >= blocks.size() || blocks[idx].first_key > key) return false;
+    const char* data = load_block(idx, block);
+    if (!data) return false;
+    uint32_t i = lower_bound_in_block(data, blocks[idx], key);
+    while (true) {
+        if (i == blocks[idx].count) {
+            if (++idx == blocks.size() || blocks[idx].first_key > key) return false;
+            data = load_block(idx, block);
+            if (!data) return false;
+            i = 0;
+        }
+        decode_view(data + entry_offset_in_block(data, blocks[idx], i), v);
+        if (v.key != key) return false;
+        if (v.seq < snapshot) return true;
+        ++i;
     }
+}
+
+// Offset of the i-th entry, from the offset array at the end of the block.
+uint32_t SSTable::entry_offset_in_block(const char* data, const table_format::BlockHandle &h, uint32_t i)
+{
+    const char* offsets = data + h.raw_size - 4 - 4 * static_cast<size_t>(h.count);
+    return table_format::get_fixed32(offsets + 4 * i);
+}
+
+// Index of the first entry whose key is >= key, or h.count.
+uint32_t SSTable::lower_bound_in_block(const char* data, const table_format::BlockHandle &h, int key)
+{
+    uint32_t left = 0, right = h.count;
+    while (left < right) {
+        uint32_t mid = left + (right - left) / 2;
+        if (static_cast<int>(table_format::get_fixed32(data + entry_offset_in_block(data, h, mid))) < key) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+    return left;
+}
+
+std::optional<templatedb::Value> SSTable::get_legacy(int key, uint64_t snapshot)
+{
+    if (!read_offset){
+        load_key_offset();
+    }
+    auto it = std::lower_bound(key_offsets.begin(), key_offsets.end(), key,
+        [](const std::pair<int, std::streampos>& kv, int k) { return kv.first < k; });
+    if (it == key_offsets.end() || it->first != key) return std::nullopt;
+
+    // own stream, so concurrent lookups on a cached table don't share a position
+    std::ifstream lookup(path);
+    lookup.seekg(it->second);
+    std::string line;
+    while (std::getline(lookup, line)) {
+        templatedb::Entry e = parse_line(line);
+        if (e.key != key) break;
+        if (e.seq >= snapshot) continue;
 
+        if (is_range_delete && is_key_covered_at(key, e.seq + 1, snapshot)) return templatedb::Value(false);
+        return e.val;
+    }
     return std::nullopt;
 }
 
@@ -231,6 +544,21 @@ void SSTable::load_entries(){
     if (!entries.empty()){
         return;
     }
+    if (!legacy) {
+        entries.reserve(size - tombs_size);
+        std::string buf;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            const char* data = block_ptr(i, buf);
+            if (!data) break;
+            size_t pos = 0;
+            for (uint32_t k = 0; k < blocks[i].count; ++k) {
+                templatedb::Entry e;
+                pos += table_format::decode_entry(data + pos, e);
+                entries.push_back(std::move(e));
+            }
+        }
+        return;
+    }
     std::string line;
     infile.clear();
     infile.seekg(entry_offset);
@@ -243,7 +571,7 @@ void SSTable::load_entries(){
         int tomb_flag, key;
         ss >> seq >> tomb_flag >> key;
 
-        std::vector<int> vals;
+        templatedb::Items vals;
         int x;
         while (ss >> x) {
             vals.push_back(x);
@@ -252,7 +580,7 @@ void SSTable::load_entries(){
         if (tomb_flag) {
             entries.push_back(templatedb::Entry{true, seq, key, templatedb::Value(false)});
         } else {
-            entries.push_back(templatedb::Entry{false, seq, key, templatedb::Value(vals)});
+            entries.push_back(templatedb::Entry{false, seq, key, templatedb::Value(std::move(vals))});
         }
     }
 }
@@ -274,59 +602,75 @@ const std::vector<templatedb::Fragment> &SSTable::getFragments() const
     return fragments;
 }
 
-bool SSTable::hasRangeDelete()
+void SSTable::load_fragments()
 {
-    return !tombs.empty();
-}
-
-static std::vector<templatedb::Fragment> build_fragments(const std::vector<templatedb::RangeTomb>& tombs) {
-    // collect bonds
-    std::set<int> bounds;
-    for (const auto& t : tombs) {
-        bounds.insert(t.start);
-        bounds.insert(t.end);
+    if (!is_range_delete || fragments_loaded) return;
+    fragments_loaded = true;
+    // a snapshot read under a fragment newer than the snapshot needs the
+    // raw tombstones, so they are decoded once along with the fragments
+    load_tombs();
+    if (fragment_section_size > 0) {
+        // written fragmented by the TableBuilder
+        std::string buf;
+        const char* data = read_ptr(fragment_offset, fragment_section_size, buf);
+        if (data) {
+            uint32_t n = table_format::get_fixed32(data);
+            fragments.reserve(n);
+            for (uint32_t i = 0; i < n; ++i) {
+                const char* p = data + 4 + table_format::FRAGMENT_SIZE * i;
+                fragments.push_back(templatedb::Fragment{static_cast<int>(table_format::get_fixed32(p)),
+                    static_cast<int>(table_format::get_fixed32(p + 4)), table_format::get_fixed64(p + 8)});
+            }
+            return;
+        }
     }
+    // tables written before the fragment section
+    fragments = build_fragments(tombs);
+}
 
-    std::vector<int> sorted_bounds(bounds.begin(), bounds.end());
-    std::vector<templatedb::Fragment> fragments;
+size_t SSTable::memory_usage() const
+{
+    return sizeof(SSTable)
+        + key_offsets.capacity() * sizeof(std::pair<int, std::streampos>)
+        + tombs.capacity() * sizeof(templatedb::RangeTomb)
+        + fragments.capacity() * sizeof(templatedb::Fragment)
+        + entries.capacity() * sizeof(templatedb::Entry)
+        + blocks.capacity() * sizeof(table_format::BlockHandle)
+        + (bloomFilter ? bloomFilter->getNumBits() / 8 : 0);
+}
 
-    for (size_t i = 0; i + 1 < sorted_bounds.size(); ++i) {
-        int a = sorted_bounds[i];
-        int b = sorted_bounds[i + 1];
+bool SSTable::is_legacy() const
+{
+    return legacy;
+}
 
-        uint64_t max_seq = 0;
-        for (const auto& t : tombs) {
-            if (a >= t.start && b <= t.end) {
-                max_seq = std::max(max_seq, t.seq);
-            }
-        }
+bool SSTable::has_filter() const
+{
+    return bloomFilter != nullptr || filter_size > 0;
+}
 
-        if (max_seq > 0) {
-            fragments.push_back(templatedb::Fragment{a, b, max_seq});
-        }
-    }
+FilterStats& SSTable::filter_stats()
+{
+    static FilterStats stats;
+    return stats;
+}
 
-    return fragments;
+bool SSTable::hasRangeDelete()
+{
+    return !tombs.empty();
 }
 
 bool SSTable::is_key_covered_by_fragment(int key, uint64_t key_seq) {
-    int left = 0, right = fragments.size() - 1;
-
-    while (left <= right) {
-        int mid = (left + right) / 2;
-        const templatedb::Fragment& frag = fragments[mid];
-
-        if (key < frag.start) {
-            right = mid - 1;  // key in the left
-        } else if (key >= frag.end) {
-            left = mid + 1;   // key in the right
-        } else {
-            // key [frag.start, frag.end)
-            return frag.max_seq > key_seq;
-        }
-    }
+    return ::is_key_covered_by_fragment(fragments, key, key_seq);
+}
 
-    return false; // no hit
+// The fragments answer unless the covering one is newer than the snapshot;
+// only then are the raw tombstones read.
+bool SSTable::is_key_covered_at(int key, uint64_t from, uint64_t snapshot) {
+    const templatedb::Fragment* f = find_fragment(fragments, key);
+    if (f == nullptr || f->max_seq < from) return false;
+    if (f->max_seq < snapshot) return true;
+    return ::is_key_covered_at(*f, tombs, key, from, snapshot);
 }
 
 static bool entry_cmp(const templatedb::Entry& a, const templatedb::Entry& b) {
@@ -368,44 +712,135 @@ templatedb::Entry SSTable::parse_line(const std::string& line) {
     uint64_t seq;
     int tomb_flag, key;
     ss >> seq >> tomb_flag >> key;
-    std::vector<int> items;
+    templatedb::Items items;
     int x;
     while (ss >> x) items.push_back(x);
     if (tomb_flag) {
         return templatedb::Entry{true, seq, key, templatedb::Value(false)};
     } 
-    return templatedb::Entry{false, seq, key, templatedb::Value(items)};
+    return templatedb::Entry{false, seq, key, templatedb::Value(std::move(items))};
+}
+
+SSTable::Cursor::Cursor(SSTable *new_table)
+{
+    table = new_table;
 }
 
-std::optional<templatedb::Entry> SSTable::next()
+void SSTable::Cursor::seek_to_first()
 {
-    if (!has_next()) 
+    pinned = nullptr;
+    data = nullptr;
+    block = 0;
+    count = 0;
+    index = 0;
+    pos = 0;
+}
+
+// Positions the cursor at the first entry whose key is >= key: a binary
+// search over the fences picks the block, a second one over the block's
+// entry offsets picks the entry. Reading then continues block by block.
+void SSTable::Cursor::seek(int key)
+{
+    seek_to_first();
+    if (table->legacy) {
+        const auto& offsets = table->key_offsets;
+        auto it = std::lower_bound(offsets.begin(), offsets.end(), key,
+            [](const std::pair<int, std::streampos>& kv, int k) { return kv.first < k; });
+        index = it - offsets.begin();
+        return;
+    }
+    const auto& blocks = table->blocks;
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), key,
+        [](const table_format::BlockHandle& b, int k) { return b.last_key < k; });
+    if (it == blocks.end()) {
+        block = blocks.size();
+        return;
+    }
+    size_t idx = it - blocks.begin();
+    if (!enter_block(idx)) {
+        block = blocks.size();
+        return;
+    }
+    index = lower_bound_in_block(data, blocks[idx], key);
+    if (index < count)
+        pos = entry_offset_in_block(data, blocks[idx], index);
+}
+
+bool SSTable::Cursor::has_next() const
+{
+    if (!table->legacy)
+        return index < count || block < table->blocks.size();
+    return index < table->key_offsets.size();
+}
+
+// The view stays valid until the next call (pread mode reuses the block
+// buffer) or, for mapped files, for the lifetime of the table.
+std::optional<table_format::EntryView> SSTable::Cursor::next_view()
+{
+    if (!has_next())
         return std::nullopt;
-    infile.clear();
-    infile.seekg(key_offsets[iter_index].second);
+    table_format::EntryView v;
+    if (!table->legacy) {
+        // walk a whole block at a time and decode entries sequentially from it
+        if (index >= count && !enter_block(block))
+            return std::nullopt;
+        pos += table_format::decode_view(data + pos, v);
+        index++;
+        return v;
+    }
+    // a stream of its own, the table's is shared; entries are read in
+    // file order, so it only seeks when jumping
+    if (!legacy_file.is_open())
+        legacy_file.open(table->path, std::ios::binary);
+    legacy_file.clear();
+    if (legacy_file.tellg() != table->key_offsets[index].second)
+        legacy_file.seekg(table->key_offsets[index].second);
     std::string line;
-    if (!std::getline(infile, line)) 
+    if (!std::getline(legacy_file, line))
         return std::nullopt;
-    
-    templatedb::Entry e = parse_line(line);
-    iter_index++;
-    // std::cout << "[DEBUG] SSTable::next() idx=" << iter_index << "\n";
-    // std::cout << "key offset"<< key_offsets.size() <<"\n";
-    return e;
+    templatedb::Entry e = table->parse_line(line);
+    index++;
+    buf.clear();
+    table_format::encode_entry(buf, e);
+    table_format::decode_view(buf.data(), v);
+    return v;
 }
 
-void SSTable::reset_iterator()
+void SSTable::Cursor::set_readahead(bool enable)
 {
-    iter_index = 0;
+    readahead = enable;
 }
 
-bool SSTable::has_next()
+// Makes block idx the one next_view() decodes from, starting at its first
+// entry. Scans use blocks already cached but don't fill the cache, so one
+// long scan cannot flush the hot point-lookup set.
+bool SSTable::Cursor::enter_block(size_t idx)
 {
-    return iter_index < key_offsets.size();
+    const auto& blocks = table->blocks;
+    pinned = nullptr;
+    if (table->cache_id != 0)
+        pinned = BlockCache::instance().lookup<std::string>(table->cache_id, blocks[idx].offset);
+    // the mapping stays advised for random reads, which other readers of a
+    // cached table rely on, so a long scan asks for the next blocks itself
+    if (readahead && table->mapping && idx % READAHEAD_BLOCKS == 0) {
+        size_t last = std::min(idx + READAHEAD_BLOCKS, blocks.size()) - 1;
+        table->mapping->will_need(blocks[idx].offset, blocks[last].offset + blocks[last].size - blocks[idx].offset);
+    }
+    data = pinned ? pinned->data() : table->block_ptr(idx, buf);
+    if (!data)
+        return false;
+    count = blocks[idx].count;
+    block = idx + 1;
+    index = 0;
+    pos = 0;
+    return true;
 }
 
 std::optional<templatedb::RangeTomb> SSTable::range_tombs_next(){
     if (!range_tombs_has_next()) return std::nullopt;
+    if (!legacy) {
+        return tombs[range_iter_index++];
+    }
 
     std::string line;
     if (!std::getline(tombfile, line)) return std::nullopt;
@@ -424,6 +859,11 @@ bool SSTable::range_tombs_has_next(){
 };
 
 void SSTable::reset_range_iterator(){
+    if (!legacy) {
+        load_tombs();
+        range_iter_index = 0;
+        return;
+    }
     if (tombfile.is_open()){
         tombfile.close();
     }
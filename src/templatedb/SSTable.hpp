@@ -6,24 +6,40 @@
 #include <optional>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <atomic>
 
-// #include "../BloomFilter/BloomFilter.h"
+#include "../BloomFilter/BloomFilter.h"
 #include "struct.hpp"
+#include "TableFormat.hpp"
+#include "MappedFile.hpp"
+#include "BlockCache.hpp"
+
+// Process-wide Bloom filter counters, summed over every SSTable::get.
+struct FilterStats {
+    std::atomic<uint64_t> checks{0};          // lookups that consulted a filter
+    std::atomic<uint64_t> negatives{0};       // filter said no: index search and read skipped
+    std::atomic<uint64_t> false_positives{0}; // filter said maybe but the key was absent
+};
 
 class SSTable
 {
 public:
-    // BF::BloomFilter *bloomFilter;
     SSTable();
     SSTable(const std::vector<templatedb::Entry>& entries,
         const std::vector<templatedb::RangeTomb>& tombs,
         int min, int max,
         uint64_t size, uint64_t seq_start);
-    SSTable(const std::string& filePath);
+    // block_cache_id keys this file's blocks in the BlockCache; 0 draws a fresh one
+    SSTable(const std::string& filePath, bool use_mmap = true, uint64_t block_cache_id = 0);
     bool save(const std::string& filePath);
 
-    std::optional<templatedb::Value> get(int key);
-    
+    // newest version of key below snapshot (everything by default)
+    std::optional<templatedb::Value> get(int key, uint64_t snapshot = UINT64_MAX);
+    // keys sorted ascending and distinct; out[i] answers keys[i] like get()
+    void multi_get(const std::vector<int>& keys, std::vector<std::optional<templatedb::Value>>& out,
+        uint64_t snapshot = UINT64_MAX);
+
     // void add(int key, const templatedb::Value& val, uint64_t seq);
     // void point_delete(int key, uint64_t seq);
     // void range_delete(int min, int max, uint64_t seq);
@@ -32,6 +48,13 @@ public:
     const std::vector<templatedb::Fragment>& getFragments() const;
     bool hasRangeDelete();
     bool is_key_covered_by_fragment(int key, uint64_t key_seq);
+    // a tombstone with seq in [from, snapshot) covers key
+    bool is_key_covered_at(int key, uint64_t from, uint64_t snapshot);
+    void load_fragments();
+    size_t memory_usage() const;
+    bool is_legacy() const;
+    bool has_filter() const;
+    static FilterStats& filter_stats();
 
     void sort_entries();
     void sort_tombs();
@@ -40,9 +63,39 @@ public:
     int get_min();
     int get_max();
     templatedb::Entry parse_line(const std::string &line);
-    std::optional<templatedb::Entry> next();
-    bool has_next();
-    void reset_iterator();
+    void advise(MappedFile::Access access);
+
+    // One reader's position in the table's entries, in key order. It only
+    // reads the table, so any number of cursors can walk one table shared
+    // through the TableCache at once. The table must outlive its cursors.
+    class Cursor
+    {
+    public:
+        explicit Cursor(SSTable* table);
+        void seek_to_first();
+        // next_view() then starts at the first entry whose key is >= key
+        void seek(int key);
+        bool has_next() const;
+        std::optional<table_format::EntryView> next_view();
+        // prefetch mapped blocks ahead of the cursor, for long scans
+        void set_readahead(bool enable);
+
+    private:
+        static const size_t READAHEAD_BLOCKS = 16;
+        SSTable* table;
+        std::shared_ptr<const std::string> pinned;
+        const char* data = nullptr;
+        size_t block = 0; // next block to enter
+        size_t pos = 0;
+        uint32_t count = 0;
+        size_t index = 0; // entry in the block, or key in key_offsets for legacy tables
+        std::string buf;
+        std::ifstream legacy_file;
+        bool readahead = false;
+
+        bool enter_block(size_t idx);
+    };
+
     std::optional<templatedb::RangeTomb> range_tombs_next();
     bool range_tombs_has_next();
     void reset_range_iterator();
@@ -53,11 +106,13 @@ private:
     std::vector<templatedb::Fragment> fragments;
     bool is_range_delete = false;
     bool read_offset = false;
+    bool fragments_loaded = false;
+    bool legacy = false;
+    bool corrupt = false; // binary footer found, but a section failed its bounds check
     uint64_t size = 0;
     uint64_t tombs_size = 0;
     uint64_t seq_start = 0;
     int min = 0, max;
-    int iter_index = 0;
     int range_iter_index = 0;
     std::string path;
     std::ifstream infile;
@@ -65,8 +120,40 @@ private:
     std::streampos entry_offset;
     std::streampos tomb_offset;
     std::streamoff key_index_offset;
-    std::vector<std::pair<int, std::streampos>> key_offsets;
+    std::vector<std::pair<int, std::streampos>> key_offsets; // legacy only
+    // binary format
+    std::unique_ptr<BF::BloomFilter> bloomFilter;
+    std::vector<table_format::BlockHandle> blocks; // one fence pointer per data block
+    uint64_t tomb_section_size = 0;
+    uint64_t fragment_offset = 0;
+    uint64_t fragment_section_size = 0;
+    std::unique_ptr<MappedFile> mapping;
+    std::unique_ptr<RandomAccessFile> file;
+    // pread mode: blocks and the filter go through the shared BlockCache
+    uint64_t cache_id = 0;
+    uint64_t filter_offset = 0;
+    uint64_t filter_size = 0;
+    bool open_binary();
+    void open_legacy();
+    bool read_at(uint64_t offset, size_t n, std::string& out);
+    const char* read_ptr(uint64_t offset, size_t n, std::string& scratch);
+    const char* block_ptr(size_t idx, std::string& scratch);
+    // a data block held while its entries are decoded
+    struct BlockRef {
+        size_t idx = SIZE_MAX;
+        const char* data = nullptr;
+        std::shared_ptr<const std::string> pinned;
+        std::string scratch;
+    };
+    const char* load_block(size_t idx, BlockRef& block);
+    std::shared_ptr<const std::string> cached_block(size_t idx);
+    std::shared_ptr<const BF::BloomFilter> filter();
     void load_key_offset();
+    bool find_version(size_t idx, int key, uint64_t snapshot, table_format::EntryView& v, BlockRef& block);
+    std::optional<templatedb::Value> get_legacy(int key, uint64_t snapshot);
+    static uint32_t entry_offset_in_block(const char* data, const table_format::BlockHandle& h, uint32_t i);
+    static uint32_t lower_bound_in_block(const char* data, const table_format::BlockHandle& h, int key);
     void load_tombs();
+    std::vector<templatedb::RangeTomb> read_tombs();
     void load_entries();
 };
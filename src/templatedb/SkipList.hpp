@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <random>
+#include <type_traits>
+
+#include "Arena.hpp"
+
+// Ordered set of T under Compare (strict weak order). Inserts and seeks are
+// O(log n) expected, and iteration walks the bottom level in sorted order.
+// Nodes live in the caller's Arena and are never freed one by one, so T must
+// be trivially destructible (the MemTable stores pointers into the arena).
+// Inserts must be serialized by the caller, but readers need no lock: a node
+// is fully built before a release store links it in, and readers follow the
+// links with acquire loads.
+template <typename T, typename Compare>
+class SkipList
+{
+    static_assert(std::is_trivially_destructible<T>::value, "nodes are never destroyed");
+
+private:
+    struct Node {
+        T value;
+        std::atomic<Node*> next[1]; // height entries, allocated past the end of the struct
+
+        Node* load(int level) const { return next[level].load(std::memory_order_acquire); }
+        void store(int level, Node* x) { next[level].store(x, std::memory_order_release); }
+    };
+
+public:
+    static const int MAX_HEIGHT = 16;
+
+    class Iterator
+    {
+    public:
+        Iterator() {}
+        explicit Iterator(const SkipList* list) : list(list) {}
+
+        bool valid() const { return node != nullptr; }
+        const T& value() const { return node->value; }
+        void next() { node = node->load(0); }
+        void seek_to_first() { node = list->head->load(0); }
+        // first element >= target
+        void seek(const T& target) { node = list->find_greater_or_equal(target, nullptr); }
+
+    private:
+        const SkipList* list = nullptr;
+        Node* node = nullptr;
+    };
+
+    SkipList(Compare cmp, Arena* arena) : cmp(cmp), arena(arena), rng(0x5eed)
+    {
+        head = new_node(T(), MAX_HEIGHT);
+    }
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
+
+    void insert(const T& value)
+    {
+        Node* prev[MAX_HEIGHT];
+        find_greater_or_equal(value, prev);
+
+        int h = random_height();
+        int old_height = height.load(std::memory_order_relaxed);
+        if (h > old_height) {
+            for (int i = old_height; i < h; ++i) prev[i] = head;
+            // a reader that sees the new height before the node just finds
+            // null links from head at the new levels and drops down
+            height.store(h, std::memory_order_relaxed);
+        }
+        Node* node = new_node(value, h);
+        for (int i = 0; i < h; ++i) {
+            node->next[i].store(prev[i]->next[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            prev[i]->store(i, node);
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    bool empty() const { return size() == 0; }
+    Iterator iterator() const { return Iterator(this); }
+
+private:
+    Compare cmp;
+    Arena* arena;
+    Node* head;
+    std::atomic<int> height{1};
+    std::atomic<size_t> count{0};
+    std::minstd_rand rng;
+
+    Node* new_node(const T& value, int h)
+    {
+        char* mem = arena->allocate_aligned(sizeof(Node) + sizeof(Node*) * (h - 1));
+        Node* node = new (mem) Node;
+        node->value = value;
+        for (int i = 0; i < h; ++i) new (&node->next[i]) std::atomic<Node*>(nullptr);
+        return node;
+    }
+
+    int random_height()
+    {
+        // branching factor 4
+        int h = 1;
+        while (h < MAX_HEIGHT && (rng() & 3) == 0) h++;
+        return h;
+    }
+
+    Node* find_greater_or_equal(const T& target, Node** prev) const
+    {
+        Node* x = head;
+        int level = height.load(std::memory_order_relaxed) - 1;
+        while (true) {
+            Node* next = x->load(level);
+            if (next != nullptr && cmp(next->value, target)) {
+                x = next;
+            } else {
+                if (prev != nullptr) prev[level] = x;
+                if (level == 0) return next;
+                level--;
+            }
+        }
+    }
+};
@@ -0,0 +1,224 @@
+#include "TableBuilder.hpp"
+#include "../BloomFilter/BloomFilter.h"
+#include "Fragments.hpp"
+#include "BlockCodec.hpp"
+#include <algorithm>
+#include <climits>
+
+using namespace table_format;
+
+TableBuilder::TableBuilder(const std::string &filePath, int new_bits_per_key, Compression new_compression)
+{
+    bits_per_key = new_bits_per_key;
+    compression = new_compression;
+    file.open(filePath, std::ios::binary | std::ios::trunc);
+    good = file.is_open();
+    props.min = INT32_MAX;
+    props.max = INT32_MIN;
+    props.seq_start = UINT64_MAX;
+}
+
+bool TableBuilder::ok() const
+{
+    return good;
+}
+
+void TableBuilder::add(const templatedb::Entry &e)
+{
+    start_entry(e.key, ENTRY_HEADER_SIZE + 4 * e.val.items.size());
+    encode_entry(block, e);
+    if (e.tomb) deletions++;
+    finish_entry(e.key, e.seq);
+}
+
+void TableBuilder::add(const EntryView &v)
+{
+    start_entry(v.key, v.length());
+    block.append(v.data, v.length());
+    if (v.tomb) deletions++;
+    finish_entry(v.key, v.seq);
+}
+
+void TableBuilder::start_entry(int key, size_t length)
+{
+    if (!block.empty() && block.size() + length > BLOCK_SIZE) {
+        flush_block();
+    }
+    if (block.empty()) {
+        block_first_key = key;
+    }
+    if (bits_per_key > 0 && (!has_last_key || key != last_key)) {
+        filter_keys.push_back(key);
+    }
+    block_offsets.push_back(static_cast<uint32_t>(block.size()));
+}
+
+void TableBuilder::finish_entry(int key, uint64_t seq)
+{
+    block_last_key = key;
+    last_key = key;
+    has_last_key = true;
+
+    entries++;
+    props.size++;
+    props.min = std::min(props.min, key);
+    props.max = std::max(props.max, key);
+    props.seq_start = std::min(props.seq_start, seq);
+    seq_end = std::max(seq_end, seq);
+}
+
+void TableBuilder::add_tomb(const templatedb::RangeTomb &t)
+{
+    tombs.push_back(t);
+    deletions++;
+    props.size++;
+    props.tombs_size++;
+    props.min = std::min(props.min, t.start);
+    props.max = std::max(props.max, t.end - 1); // end is exclusive
+    props.seq_start = std::min(props.seq_start, t.seq);
+    seq_end = std::max(seq_end, t.seq);
+}
+
+void TableBuilder::flush_block()
+{
+    if (block_offsets.empty()) return;
+    for (uint32_t off : block_offsets) put_fixed32(block, off);
+    put_fixed32(block, static_cast<uint32_t>(block_offsets.size()));
+
+    const std::string& stored = compress_block(compression, block.data(), block.size(), compressed)
+        ? compressed : block;
+    blocks.push_back(BlockHandle{block_first_key, block_last_key, offset,
+        static_cast<uint32_t>(stored.size()), static_cast<uint32_t>(block_offsets.size()),
+        static_cast<uint32_t>(block.size())});
+    file.write(stored.data(), stored.size());
+    offset += stored.size();
+    CompressionStats& stats = compression_stats();
+    stats.raw_bytes += block.size();
+    stats.stored_bytes += stored.size();
+    block.clear();
+    block_offsets.clear();
+}
+
+uint64_t TableBuilder::write_section(const std::string &data)
+{
+    uint64_t start = offset;
+    file.write(data.data(), data.size());
+    offset += data.size();
+    return start;
+}
+
+bool TableBuilder::finish()
+{
+    if (!good) return false;
+    flush_block();
+    if (props.size == 0) {
+        props.min = 0;
+        props.max = 0;
+        props.seq_start = 0;
+    }
+
+    std::string tomb_section;
+    put_fixed32(tomb_section, static_cast<uint32_t>(tombs.size()));
+    for (const auto& t : tombs) {
+        put_fixed32(tomb_section, static_cast<uint32_t>(t.start));
+        put_fixed32(tomb_section, static_cast<uint32_t>(t.end));
+        put_fixed64(tomb_section, t.seq);
+    }
+
+    // readers load these as is instead of fragmenting on open
+    std::string fragment_section;
+    std::vector<templatedb::Fragment> fragments = build_fragments(tombs);
+    put_fixed32(fragment_section, static_cast<uint32_t>(fragments.size()));
+    for (const auto& f : fragments) {
+        put_fixed32(fragment_section, static_cast<uint32_t>(f.start));
+        put_fixed32(fragment_section, static_cast<uint32_t>(f.end));
+        put_fixed64(fragment_section, f.max_seq);
+    }
+
+    std::string block_section;
+    put_fixed32(block_section, static_cast<uint32_t>(blocks.size()));
+    for (const auto& b : blocks) {
+        put_fixed32(block_section, static_cast<uint32_t>(b.first_key));
+        put_fixed32(block_section, static_cast<uint32_t>(b.last_key));
+        put_fixed64(block_section, b.offset);
+        put_fixed32(block_section, b.size);
+        put_fixed32(block_section, b.count);
+        put_fixed32(block_section, b.raw_size);
+    }
+
+    std::string prop_section;
+    put_fixed64(prop_section, props.size);
+    put_fixed64(prop_section, props.tombs_size);
+    put_fixed32(prop_section, static_cast<uint32_t>(props.min));
+    put_fixed32(prop_section, static_cast<uint32_t>(props.max));
+    put_fixed64(prop_section, props.seq_start);
+
+    std::string meta;
+    uint32_t sections = 0;
+    auto add_meta = [&](SectionType type, const std::string& data) {
+        uint64_t start = write_section(data);
+        put_fixed32(meta, type);
+        put_fixed64(meta, start);
+        put_fixed64(meta, data.size());
+        sections++;
+    };
+    if (bits_per_key > 0) {
+        BF::BloomFilter filter(static_cast<int>(filter_keys.size()), bits_per_key);
+        for (int key : filter_keys) filter.program(key);
+        add_meta(FILTER, filter.serialize());
+    }
+    add_meta(TOMBSTONES, tomb_section);
+    if (!fragments.empty()) add_meta(FRAGMENTS, fragment_section);
+    add_meta(BLOCK_INDEX, block_section);
+    add_meta(PROPERTIES, prop_section);
+
+    std::string section_count;
+    put_fixed32(section_count, sections);
+    uint64_t meta_offset = write_section(section_count + meta);
+
+    std::string footer;
+    put_fixed64(footer, meta_offset);
+    put_fixed32(footer, static_cast<uint32_t>(section_count.size() + meta.size()));
+    put_fixed32(footer, VERSION);
+    put_fixed64(footer, MAGIC);
+    write_section(footer);
+
+    file.close();
+    good = !file.fail();
+    return good;
+}
+
+uint64_t TableBuilder::num_entries() const
+{
+    return entries;
+}
+
+uint64_t TableBuilder::num_deletions() const
+{
+    return deletions;
+}
+
+uint64_t TableBuilder::file_size() const
+{
+    return offset;
+}
+
+int TableBuilder::min_key() const
+{
+    return props.min;
+}
+
+int TableBuilder::max_key() const
+{
+    return props.max;
+}
+
+uint64_t TableBuilder::smallest_seq() const
+{
+    return entries == 0 && tombs.empty() ? 0 : props.seq_start;
+}
+
+uint64_t TableBuilder::largest_seq() const
+{
+    return seq_end;
+}
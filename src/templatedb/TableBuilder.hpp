@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+
+#include "struct.hpp"
+#include "TableFormat.hpp"
+
+// Streams sorted entries (key asc, seq desc) into a binary SSTable file.
+// Data blocks are written as soon as they fill up, so only the block index,
+// the filter keys and the range tombstones are held in memory until finish().
+class TableBuilder
+{
+public:
+    // bits_per_key <= 0 writes no Bloom filter; blocks that compression
+    // does not shrink are stored as is
+    TableBuilder(const std::string& filePath, int bits_per_key = 10,
+        table_format::Compression compression = table_format::NO_COMPRESSION);
+    bool ok() const;
+
+    void add(const templatedb::Entry& e);
+    // copies an already encoded entry, e.g. straight out of another table
+    void add(const table_format::EntryView& v);
+    void add_tomb(const templatedb::RangeTomb& t);
+    bool finish();
+
+    uint64_t num_entries() const;
+    // point and range tombstones added so far
+    uint64_t num_deletions() const;
+    uint64_t file_size() const;
+    // smallest and largest key added so far, range tombstone ends included
+    int min_key() const;
+    int max_key() const;
+    // oldest and newest seq added so far, entries and range tombstones alike
+    uint64_t smallest_seq() const;
+    uint64_t largest_seq() const;
+
+private:
+    std::ofstream file;
+    std::string block;
+    std::string compressed;
+    std::vector<uint32_t> block_offsets;
+    std::vector<table_format::BlockHandle> blocks;
+    std::vector<int> filter_keys; // distinct keys, only kept when a filter is written
+    std::vector<templatedb::RangeTomb> tombs;
+    table_format::Properties props;
+    uint64_t offset = 0;
+    uint64_t entries = 0;
+    uint64_t deletions = 0;
+    uint64_t seq_end = 0;
+    int bits_per_key;
+    table_format::Compression compression;
+    int block_first_key = 0;
+    int block_last_key = 0;
+    bool has_last_key = false;
+    int last_key = 0;
+    bool good = false;
+
+    void start_entry(int key, size_t length);
+    void finish_entry(int key, uint64_t seq);
+    void flush_block();
+    uint64_t write_section(const std::string& data);
+};
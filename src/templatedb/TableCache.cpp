@@ -0,0 +1,115 @@
+#include "TableCache.hpp"
+
+TableCache::TableCache(size_t new_max_open_files, size_t new_memory_budget)
+{
+    max_open_files = new_max_open_files;
+    memory_budget = new_memory_budget;
+}
+
+uint64_t TableCache::make_id(int level, uint64_t num)
+{
+    return (static_cast<uint64_t>(static_cast<uint16_t>(level)) << 48) | (num & 0xffffffffffffULL);
+}
+
+std::shared_ptr<SSTable> TableCache::get(int level, uint64_t num, const std::string &filePath)
+{
+    uint64_t id = make_id(level, num);
+    bool mmap_enabled;
+    uint64_t block_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tables.find(id);
+        if (it != tables.end()) {
+            // move to front
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->table;
+        }
+        mmap_enabled = use_mmap;
+        uint64_t& known = block_ids[id];
+        if (known == 0) known = BlockCache::new_file_id();
+        block_id = known;
+    }
+
+    // open outside the lock, another thread may race us to it
+    auto table = std::make_shared<SSTable>(filePath, mmap_enabled, block_id);
+    table->load_fragments();
+    size_t charge = table->memory_usage();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tables.find(id);
+    if (it != tables.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->table;
+    }
+    lru.push_front(Handle{id, table, charge});
+    tables[id] = lru.begin();
+    usage += charge;
+    evict_to_budget();
+    return table;
+}
+
+void TableCache::evict(int level, uint64_t num)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t id = make_id(level, num);
+    // the file is gone, its cached blocks just age out
+    block_ids.erase(id);
+    auto it = tables.find(id);
+    if (it == tables.end()) return;
+    usage -= it->second->charge;
+    lru.erase(it->second);
+    tables.erase(it);
+}
+
+void TableCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    tables.clear();
+    block_ids.clear();
+    usage = 0;
+}
+
+void TableCache::evict_to_budget()
+{
+    // always keep the most recently used table, callers hold it anyway
+    while (lru.size() > 1 && (lru.size() > max_open_files || usage > memory_budget)) {
+        Handle& victim = lru.back();
+        usage -= victim.charge;
+        tables.erase(victim.id);
+        lru.pop_back();
+    }
+}
+
+void TableCache::set_max_open_files(size_t num)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    max_open_files = num;
+    evict_to_budget();
+}
+
+void TableCache::set_memory_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memory_budget = bytes;
+    evict_to_budget();
+}
+
+void TableCache::set_use_mmap(bool enable)
+{
+    // only tables opened from now on are affected
+    std::lock_guard<std::mutex> lock(mutex);
+    use_mmap = enable;
+}
+
+size_t TableCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
+
+size_t TableCache::memory_usage() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return usage;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "SSTable.hpp"
+
+// Keeps opened SSTables (file handle, key index, fragments) alive between
+// DB::get calls. Entries are keyed by (level, file number) and evicted in
+// LRU order once either the open-file count or the memory budget is exceeded.
+// A file keeps its BlockCache id across evictions, so reopening it still
+// hits the blocks cached by its earlier handle.
+// Safe to call from several threads.
+class TableCache
+{
+public:
+    TableCache(size_t max_open_files = 256, size_t memory_budget = 64 << 20);
+
+    std::shared_ptr<SSTable> get(int level, uint64_t num, const std::string& filePath);
+    void evict(int level, uint64_t num);
+    void clear();
+
+    void set_max_open_files(size_t num);
+    void set_memory_budget(size_t bytes);
+    void set_use_mmap(bool enable);
+    size_t size() const;
+    size_t memory_usage() const;
+
+private:
+    struct Handle {
+        uint64_t id;
+        std::shared_ptr<SSTable> table;
+        size_t charge;
+    };
+
+    std::list<Handle> lru; // front = most recently used
+    std::unordered_map<uint64_t, std::list<Handle>::iterator> tables;
+    std::unordered_map<uint64_t, uint64_t> block_ids; // table id -> BlockCache file id
+    size_t max_open_files;
+    size_t memory_budget;
+    size_t usage = 0;
+    bool use_mmap = true;
+    mutable std::mutex mutex;
+
+    static uint64_t make_id(int level, uint64_t num);
+    void evict_to_budget();
+};
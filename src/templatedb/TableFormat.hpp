@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "struct.hpp"
+
+// Binary SSTable layout (see format.txt). All integers are fixed width and
+// little endian so a reader can decode them straight out of a byte buffer.
+namespace table_format {
+
+const uint64_t MAGIC = 0x31424453424d534cULL; // "LSMBSDB1"
+const uint32_t VERSION = 3; // 2 dropped the per-key index, 3 added compressed blocks
+const size_t BLOCK_SIZE = 4096;
+const size_t FOOTER_SIZE = 24; // meta offset (8), meta size (4), version (4), magic (8)
+const size_t ENTRY_HEADER_SIZE = 15; // key (4), seq (8), tomb (1), dims (2)
+const size_t TOMB_SIZE = 16; // start (4), end (4), seq (8)
+const size_t FRAGMENT_SIZE = 16; // start (4), end (4), max seq (8)
+const size_t BLOCK_HANDLE_SIZE = 28; // first key (4), last key (4), offset (8), size (4), count (4), raw size (4)
+const size_t BLOCK_HANDLE_SIZE_V2 = 24; // no raw size, blocks are stored as is
+const size_t META_ENTRY_SIZE = 20; // type (4), offset (8), size (8)
+const size_t PROPERTIES_SIZE = 32; // size (8), tombs (8), min (4), max (4), seq start (8)
+
+enum SectionType : uint32_t {
+    PROPERTIES = 1,
+    TOMBSTONES = 2,
+    KEY_INDEX = 3, // version 1 only, ignored
+    BLOCK_INDEX = 4,
+    FILTER = 5,
+    FRAGMENTS = 6, // range tombstones already fragmented, absent when there are none
+};
+
+// How a data block is stored. A compressed block starts with its codec and
+// is decoded back into the plain layout before any entry is read.
+enum Compression : uint8_t {
+    NO_COMPRESSION = 0,
+    DELTA_VARINT = 1, // key and seq deltas, values as zigzag varints
+    BIT_PACKED = 2,   // key deltas and each value column frame-of-reference bit packed
+};
+
+struct BlockHandle {
+    int first_key;
+    int last_key;
+    uint64_t offset;
+    uint32_t size;     // bytes on disk
+    uint32_t count;
+    uint32_t raw_size; // bytes once decoded, equal to size for a plain block
+};
+
+struct Properties {
+    uint64_t size = 0;       // entries + range tombstones
+    uint64_t tombs_size = 0; // range tombstones
+    int min = 0, max = 0;
+    uint64_t seq_start = 0;
+};
+
+inline void put_fixed16(std::string& dst, uint16_t v)
+{
+    char buf[2] = {static_cast<char>(v), static_cast<char>(v >> 8)};
+    dst.append(buf, 2);
+}
+
+inline void put_fixed32(std::string& dst, uint32_t v)
+{
+    char buf[4];
+    for (int i = 0; i < 4; ++i) buf[i] = static_cast<char>(v >> (8 * i));
+    dst.append(buf, 4);
+}
+
+inline void put_fixed64(std::string& dst, uint64_t v)
+{
+    char buf[8];
+    for (int i = 0; i < 8; ++i) buf[i] = static_cast<char>(v >> (8 * i));
+    dst.append(buf, 8);
+}
+
+inline uint16_t get_fixed16(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>(u[0] | (u[1] << 8));
+}
+
+inline uint32_t get_fixed32(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8)
+        | (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+inline uint64_t get_fixed64(const char* p)
+{
+    return static_cast<uint64_t>(get_fixed32(p)) | (static_cast<uint64_t>(get_fixed32(p + 4)) << 32);
+}
+
+inline void encode_entry(std::string& dst, const templatedb::Entry& e)
+{
+    put_fixed32(dst, static_cast<uint32_t>(e.key));
+    put_fixed64(dst, e.seq);
+    dst.push_back(e.tomb ? 1 : 0);
+    put_fixed16(dst, static_cast<uint16_t>(e.tomb ? 0 : e.val.items.size()));
+    if (!e.tomb) {
+        for (int v : e.val.items) put_fixed32(dst, static_cast<uint32_t>(v));
+    }
+}
+
+// Points into an encoded entry. Nothing is copied until value() or
+// to_entry() is called, and the view is only valid while the bytes it
+// points to are (the mapping, or the block buffer it was decoded from).
+struct EntryView {
+    int key = 0;
+    uint64_t seq = 0;
+    bool tomb = false;
+    uint16_t dims = 0;
+    const char* data = nullptr;
+
+    size_t length() const { return ENTRY_HEADER_SIZE + 4 * static_cast<size_t>(dims); }
+    int item(size_t i) const { return static_cast<int>(get_fixed32(data + ENTRY_HEADER_SIZE + 4 * i)); }
+
+    templatedb::Value value() const
+    {
+        if (tomb) return templatedb::Value(false);
+        templatedb::Value val;
+        val.items.resize(dims);
+        for (uint16_t i = 0; i < dims; ++i) val.items[i] = item(i);
+        return val;
+    }
+
+    templatedb::Entry to_entry() const
+    {
+        return templatedb::Entry{tomb, seq, key, value()};
+    }
+};
+
+// Decodes the entry header at p and returns the number of bytes it occupies.
+inline size_t decode_view(const char* p, EntryView& v)
+{
+    v.key = static_cast<int>(get_fixed32(p));
+    v.seq = get_fixed64(p + 4);
+    v.tomb = p[12] != 0;
+    v.dims = get_fixed16(p + 13);
+    v.data = p;
+    return v.length();
+}
+
+inline size_t decode_entry(const char* p, templatedb::Entry& e)
+{
+    EntryView v;
+    size_t len = decode_view(p, v);
+    e = v.to_entry();
+    return len;
+}
+
+inline size_t entry_length(const char* p)
+{
+    return ENTRY_HEADER_SIZE + 4 * static_cast<size_t>(get_fixed16(p + 13));
+}
+
+} // namespace table_format
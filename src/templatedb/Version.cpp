@@ -0,0 +1,91 @@
+#include "Version.hpp"
+#include "TableCache.hpp"
+#include "TableFormat.hpp"
+#include <cstdio>
+
+FileMeta::FileMeta(int new_level, uint64_t new_number, const std::string &new_path,
+    int new_min, int new_max, uint64_t new_size, TableCache* new_cache)
+{
+    level = new_level;
+    number = new_number;
+    path = new_path;
+    min = new_min;
+    max = new_max;
+    size = new_size;
+    cache = new_cache;
+}
+
+FileMeta::~FileMeta()
+{
+    if (!obsolete) return;
+    if (cache != nullptr) cache->evict(level, number);
+    std::remove(path.c_str());
+}
+
+void VersionEdit::add_file(const FileMeta &f)
+{
+    added.push_back(NewFile{f.level, f.number, f.min, f.max, f.size, f.smallest_seq, f.largest_seq,
+        f.file_size, f.deletions});
+}
+
+void VersionEdit::remove_file(const FileMeta &f)
+{
+    removed.push_back({f.level, f.number});
+}
+
+// next_file_number u64, last_seq u64,
+// added count u32, then level u32, number u64, min i32, max i32, size u64,
+//   smallest seq u64, largest seq u64, file size u64, deletions u64 per file,
+// removed count u32, then level u32, number u64 per file
+void VersionEdit::encode(std::string &dst) const
+{
+    using namespace table_format;
+    put_fixed64(dst, next_file_number);
+    put_fixed64(dst, last_seq);
+    put_fixed32(dst, static_cast<uint32_t>(added.size()));
+    for (const auto& f : added) {
+        put_fixed32(dst, static_cast<uint32_t>(f.level));
+        put_fixed64(dst, f.number);
+        put_fixed32(dst, static_cast<uint32_t>(f.min));
+        put_fixed32(dst, static_cast<uint32_t>(f.max));
+        put_fixed64(dst, f.size);
+        put_fixed64(dst, f.smallest_seq);
+        put_fixed64(dst, f.largest_seq);
+        put_fixed64(dst, f.file_size);
+        put_fixed64(dst, f.deletions);
+    }
+    put_fixed32(dst, static_cast<uint32_t>(removed.size()));
+    for (const auto& [level, number] : removed) {
+        put_fixed32(dst, static_cast<uint32_t>(level));
+        put_fixed64(dst, number);
+    }
+}
+
+bool VersionEdit::decode(const char *p, size_t n)
+{
+    using namespace table_format;
+    const size_t ADDED_SIZE = 4 + 8 + 4 + 4 + 8 + 8 + 8 + 8 + 8;
+    const size_t REMOVED_SIZE = 4 + 8;
+    const char* end = p + n;
+    if (n < 20) return false;
+    next_file_number = get_fixed64(p);
+    last_seq = get_fixed64(p + 8);
+    uint32_t count = get_fixed32(p + 16);
+    p += 20;
+    if (static_cast<size_t>(end - p) < count * ADDED_SIZE + 4) return false;
+    added.clear();
+    for (uint32_t i = 0; i < count; ++i, p += ADDED_SIZE) {
+        added.push_back(NewFile{static_cast<int>(get_fixed32(p)), get_fixed64(p + 4),
+            static_cast<int>(get_fixed32(p + 12)), static_cast<int>(get_fixed32(p + 16)),
+            get_fixed64(p + 20), get_fixed64(p + 28), get_fixed64(p + 36),
+            get_fixed64(p + 44), get_fixed64(p + 52)});
+    }
+    count = get_fixed32(p);
+    p += 4;
+    if (static_cast<size_t>(end - p) != count * REMOVED_SIZE) return false;
+    removed.clear();
+    for (uint32_t i = 0; i < count; ++i, p += REMOVED_SIZE) {
+        removed.push_back({static_cast<int>(get_fixed32(p)), get_fixed64(p + 4)});
+    }
+    return true;
+}
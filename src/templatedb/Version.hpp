@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TableCache;
+
+// One SSTable that belongs to a level. Once a compaction has replaced it the
+// file is marked obsolete, and it is removed from disk (and from the table
+// cache) when the last Version that still lists it goes away.
+struct FileMeta {
+    int level;
+    uint64_t number;
+    std::string path;
+    int min, max;
+    uint64_t size; // entries plus range tombstones
+    uint64_t smallest_seq = 0, largest_seq = 0;
+    uint64_t file_size = 0; // bytes on disk
+    uint64_t deletions = 0; // point and range tombstones among size
+    TableCache* cache = nullptr;
+    std::atomic<bool> obsolete{false};
+
+    FileMeta(int level, uint64_t number, const std::string& path,
+        int min, int max, uint64_t size, TableCache* cache);
+    ~FileMeta();
+};
+
+// Immutable set of files per level, each level ordered oldest to newest.
+// Readers hold a shared_ptr to the Version they started with, so installing
+// a flush or compaction result never changes the files under them.
+struct Version {
+    std::vector<std::vector<std::shared_ptr<FileMeta>>> levels;
+
+    int max_level() const { return static_cast<int>(levels.size()) - 1; }
+};
+
+// One change to the file set, appended to the MANIFEST whenever a flush or
+// compaction installs a new Version. Replaying the edits in order rebuilds
+// the last Version; a snapshot is just an edit that adds every live file.
+struct VersionEdit {
+    struct NewFile {
+        int level;
+        uint64_t number;
+        int min, max;
+        uint64_t size;
+        uint64_t smallest_seq, largest_seq;
+        uint64_t file_size, deletions;
+    };
+    uint64_t next_file_number = 0;
+    uint64_t last_seq = 0; // every seq below this one has been handed out
+    std::vector<NewFile> added;
+    std::vector<std::pair<int, uint64_t>> removed; // (level, number)
+
+    void add_file(const FileMeta& f);
+    void remove_file(const FileMeta& f);
+    void encode(std::string& dst) const;
+    bool decode(const char* data, size_t n);
+};
@@ -0,0 +1,141 @@
+#include "WAL.hpp"
+#include "TableFormat.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+
+using namespace table_format;
+
+uint32_t wal::crc32c(const char* data, size_t n, uint32_t crc)
+{
+    static uint32_t table[256];
+    static bool init = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)init;
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+LogWriter::LogWriter(int new_fd, const std::string &new_path)
+{
+    fd = new_fd;
+    file_path = new_path;
+}
+
+std::unique_ptr<LogWriter> LogWriter::open(const std::string &filePath)
+{
+    int fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        std::cerr << "Unable to create log " << filePath << std::endl;
+        return nullptr;
+    }
+    return std::unique_ptr<LogWriter>(new LogWriter(fd, filePath));
+}
+
+LogWriter::~LogWriter()
+{
+    ::close(fd);
+}
+
+uint64_t LogWriter::add_record(const std::string &payload)
+{
+    std::string body;
+    body.reserve(4 + payload.size());
+    put_fixed32(body, static_cast<uint32_t>(payload.size()));
+    body += payload;
+    std::string record;
+    record.reserve(4 + body.size());
+    put_fixed32(record, wal::crc32c(body.data(), body.size()));
+    record += body;
+
+    size_t done = 0;
+    while (done < record.size()) {
+        ssize_t w = ::write(fd, record.data() + done, record.size() - done);
+        if (w <= 0) {
+            std::cerr << "Unable to write log " << file_path << std::endl;
+            return 0;
+        }
+        done += w;
+    }
+    return written += record.size();
+}
+
+bool LogWriter::sync_to(uint64_t offset)
+{
+    std::lock_guard<std::mutex> lock(sync_mutex);
+    if (synced >= offset) return true; // a concurrent writer's sync covered us
+    uint64_t target = written.load();
+    if (fdatasync(fd) != 0) return false;
+    synced = target;
+    return true;
+}
+
+bool LogWriter::sync()
+{
+    return sync_to(written.load());
+}
+
+uint64_t LogWriter::size() const
+{
+    return written.load();
+}
+
+const std::string& LogWriter::path() const
+{
+    return file_path;
+}
+
+bool LogReader::replay(const std::string &filePath,
+    const std::function<void(const char* data, size_t n)> &apply)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    std::string buf(st.st_size, '\0');
+    size_t done = 0;
+    while (done < buf.size()) {
+        ssize_t r = pread(fd, &buf[done], buf.size() - done, done);
+        if (r <= 0) break;
+        done += r;
+    }
+    ::close(fd);
+    buf.resize(done);
+
+    size_t pos = 0;
+    while (pos + wal::HEADER_SIZE <= buf.size()) {
+        const char* p = buf.data() + pos;
+        uint32_t crc = get_fixed32(p);
+        uint32_t length = get_fixed32(p + 4);
+        if (pos + wal::HEADER_SIZE + length > buf.size()) break; // torn tail
+        if (wal::crc32c(p + 4, 4 + length) != crc) break;
+        apply(p + wal::HEADER_SIZE, length);
+        pos += wal::HEADER_SIZE + length;
+    }
+    if (pos != buf.size()) {
+        std::cerr << "Log " << filePath << " ends with a damaged record at offset " << pos << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool sync_file(const std::string &filePath)
+{
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
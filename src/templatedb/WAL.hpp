@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Write-ahead log. Each record is framed as
+//   crc32c u32 | length u32 | payload
+// where the checksum covers the length and the payload. A torn record at the
+// tail (crash during append) ends replay; everything before it is applied.
+namespace wal {
+
+enum RecordType : uint8_t {
+    PUT = 1,          // seq u64, key i32, dims u16, dims x i32
+    DELETE = 2,       // seq u64, key i32
+    RANGE_DELETE = 3, // seq u64, start i32, end i32
+    BATCH = 4,        // first seq u64, count u32, then per op the fields above without seq
+};
+
+const size_t HEADER_SIZE = 8;
+
+uint32_t crc32c(const char* data, size_t n, uint32_t crc = 0);
+
+} // namespace wal
+
+// Appends records to one log file. add_record is serialized by the caller
+// (only the DB's write group leader appends); sync_to may be called by many writers at once, and they
+// share one fdatasync: whoever gets the sync lock first syncs everything
+// written so far, and the others find their records already covered.
+class LogWriter
+{
+public:
+    static std::unique_ptr<LogWriter> open(const std::string& filePath);
+    ~LogWriter();
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator=(const LogWriter&) = delete;
+
+    // returns the log size after the record, 0 on a failed write
+    uint64_t add_record(const std::string& payload);
+    bool sync_to(uint64_t offset);
+    bool sync();
+    uint64_t size() const;
+    const std::string& path() const;
+
+private:
+    LogWriter(int fd, const std::string& path);
+    int fd;
+    std::string file_path;
+    std::atomic<uint64_t> written{0};
+    std::mutex sync_mutex;
+    uint64_t synced = 0; // guarded by sync_mutex
+};
+
+class LogReader
+{
+public:
+    // Calls apply for every intact record in order. Returns false if the
+    // file could not be read or stopped at a damaged record.
+    static bool replay(const std::string& filePath,
+        const std::function<void(const char* data, size_t n)>& apply);
+};
+
+// fsyncs a file that was written through a stream
+bool sync_file(const std::string& filePath);
@@ -0,0 +1,144 @@
+#include "WriteBatch.hpp"
+#include "MemTable.hpp"
+#include "TableFormat.hpp"
+#include "WAL.hpp"
+
+using namespace templatedb;
+using namespace table_format;
+
+void WriteBatch::put(int key, const Value& val)
+{
+    ops.push_back(static_cast<char>(wal::PUT));
+    put_fixed32(ops, static_cast<uint32_t>(key));
+    put_fixed16(ops, static_cast<uint16_t>(val.items.size()));
+    for (int item : val.items) put_fixed32(ops, static_cast<uint32_t>(item));
+    n++;
+}
+
+void WriteBatch::del(int key)
+{
+    ops.push_back(static_cast<char>(wal::DELETE));
+    put_fixed32(ops, static_cast<uint32_t>(key));
+    n++;
+}
+
+void WriteBatch::del(int min_key, int max_key)
+{
+    ops.push_back(static_cast<char>(wal::RANGE_DELETE));
+    put_fixed32(ops, static_cast<uint32_t>(min_key));
+    put_fixed32(ops, static_cast<uint32_t>(max_key));
+    n++;
+}
+
+void WriteBatch::clear()
+{
+    ops.clear();
+    n = 0;
+}
+
+void WriteBatch::append(const WriteBatch& other)
+{
+    ops.append(other.ops);
+    n += other.n;
+}
+
+uint32_t WriteBatch::count() const
+{
+    return n;
+}
+
+bool WriteBatch::empty() const
+{
+    return n == 0;
+}
+
+size_t WriteBatch::byte_size() const
+{
+    return ops.size();
+}
+
+// type u8, first seq u64, count u32, then the ops
+std::string WriteBatch::record(uint64_t first_seq) const
+{
+    std::string rec;
+    rec.reserve(1 + 8 + 4 + ops.size());
+    rec.push_back(static_cast<char>(wal::BATCH));
+    put_fixed64(rec, first_seq);
+    put_fixed32(rec, n);
+    rec.append(ops);
+    return rec;
+}
+
+// Size of the op at p, 0 if it runs past end or has an unknown type.
+static size_t op_size(const char* p, const char* end)
+{
+    size_t left = end - p;
+    if (left < 5) return 0;
+    switch (static_cast<uint8_t>(p[0])) {
+    case wal::PUT: {
+        if (left < 7) return 0;
+        size_t size = 7 + 4 * static_cast<size_t>(get_fixed16(p + 5));
+        return left < size ? 0 : size;
+    }
+    case wal::DELETE:
+        return 5;
+    case wal::RANGE_DELETE:
+        return left < 9 ? 0 : 9;
+    default:
+        return 0;
+    }
+}
+
+uint32_t WriteBatch::apply(const char* data, size_t size, MemTable& mem)
+{
+    const size_t header = 1 + 8 + 4;
+    if (size < header || static_cast<uint8_t>(data[0]) != wal::BATCH) return 0;
+    uint64_t seq = get_fixed64(data + 1);
+    uint32_t count = get_fixed32(data + 9);
+    const char* begin = data + header;
+    const char* end = data + size;
+
+    // check the whole record first so a bad one leaves mem untouched
+    const char* p = begin;
+    for (uint32_t i = 0; i < count; ++i) {
+        size_t len = op_size(p, end);
+        if (len == 0) return 0;
+        p += len;
+    }
+    if (p != end) return 0;
+
+    insert_ops(begin, end, count, seq, mem);
+    return count;
+}
+
+void WriteBatch::insert_into(uint64_t first_seq, MemTable& mem) const
+{
+    insert_ops(ops.data(), ops.data() + ops.size(), n, first_seq, mem);
+}
+
+// Inserts count well-formed ops from [p, end) with consecutive seqs.
+void WriteBatch::insert_ops(const char* p, const char* end, uint32_t count, uint64_t seq, MemTable& mem)
+{
+    Value val;
+    for (uint32_t i = 0; i < count; ++i, ++seq) {
+        size_t len = op_size(p, end);
+        int key = static_cast<int>(get_fixed32(p + 1));
+        switch (static_cast<uint8_t>(p[0])) {
+        case wal::PUT: {
+            uint16_t dims = get_fixed16(p + 5);
+            val.items.resize(dims);
+            for (uint16_t d = 0; d < dims; ++d)
+                val.items[d] = static_cast<int>(get_fixed32(p + 7 + 4 * d));
+            mem.add(key, val, seq);
+            break;
+        }
+        case wal::DELETE:
+            mem.point_delete(key, seq);
+            break;
+        case wal::RANGE_DELETE:
+            mem.range_delete(key, static_cast<int>(get_fixed32(p + 5)), seq);
+            break;
+        }
+        p += len;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "struct.hpp"
+
+class MemTable;
+
+namespace templatedb
+{
+
+// Puts, point deletes and range deletes applied together by DB::write. The
+// batch gets consecutive seqs in the order the ops were added, reaches the
+// MemTable under one lock, and is logged as a single WAL record, so after a
+// crash it is replayed whole or not at all.
+class WriteBatch
+{
+public:
+    void put(int key, const Value& val);
+    void del(int key);
+    void del(int min_key, int max_key); // [min, max)
+    void clear();
+    // adds the ops of other after these ones
+    void append(const WriteBatch& other);
+    uint32_t count() const;
+    bool empty() const;
+    // encoded size of the ops
+    size_t byte_size() const;
+
+    // The batch as a BATCH log record whose first op gets first_seq.
+    std::string record(uint64_t first_seq) const;
+    // Inserts every op of a BATCH record into mem. Returns the number of ops,
+    // 0 (and inserts nothing) when the record is malformed.
+    static uint32_t apply(const char* data, size_t n, MemTable& mem);
+    // Inserts the ops into mem, the first one at first_seq.
+    void insert_into(uint64_t first_seq, MemTable& mem) const;
+
+private:
+    static void insert_ops(const char* p, const char* end, uint32_t count, uint64_t seq, MemTable& mem);
+
+    std::string ops; // type u8 then the PUT/DELETE/RANGE_DELETE fields without seq
+    uint32_t n = 0;
+};
+
+} // namespace templatedb
@@ -1,30 +1,84 @@
 #include "db.hpp"
+#include "TableBuilder.hpp"
+#include "MergingIterator.hpp"
+#include "Fragments.hpp"
 #include <cmath>
 #include <set>
 #include <algorithm>
 #include <unordered_set>
 #include <queue>
+#include <filesystem>
+#include <map>
 
 using namespace templatedb;
 
 templatedb::DB::DB()
 {
-    sstables_file.push_back({});
-    levels_size.push_back(0);
+    auto version = std::make_shared<Version>();
+    version->levels.push_back({});
+    current = version;
+    compacting.push_back(false);
+    mmt = std::make_shared<MemTable>();
+    install_read_state();
+    flush_thread = std::thread(&DB::flush_worker, this);
+    for (int i = 0; i < compaction_threads; ++i)
+        compaction_workers.emplace_back(&DB::compaction_worker, this, i);
 }
 
 Value DB::get(int key)
 {
-    if (mmt.get(key).has_value()){
-        return mmt.get(key).value();
+    return get(ReadOptions(), key);
+}
+
+// The seq a read with these options sees writes below: its snapshot, or
+// everything the write groups have finished. Taken before the read state, so
+// whatever it covers is in that state's MemTables or files.
+uint64_t templatedb::DB::read_seq(const ReadOptions& options) const
+{
+    return options.snapshot ? options.snapshot->seq() : visible_seq.load(std::memory_order_acquire);
+}
+
+std::shared_ptr<const DB::ReadState> templatedb::DB::load_read_state() const
+{
+    return std::atomic_load(&read_state);
+}
+
+// Publishes the current MemTables and Version to readers. Caller holds the
+// lock and calls it after every change to mmt, imm or current.
+void templatedb::DB::install_read_state()
+{
+    auto state = std::make_shared<ReadState>();
+    state->active = mmt;
+    state->immutable.assign(imm.rbegin(), imm.rend());
+    state->version = current;
+    std::atomic_store(&read_state, std::shared_ptr<const ReadState>(std::move(state)));
+}
+
+Value DB::get(const ReadOptions& options, int key)
+{
+    uint64_t snapshot = read_seq(options);
+    std::shared_ptr<const ReadState> state = load_read_state();
+    std::optional<Value> in_mem = state->active->get(key, snapshot);
+    if (in_mem.has_value()){
+        return in_mem.value();
     }
-    for (int i = 0; i <= max_level; i++){
-        if (sstables_file.at(i).size() == 0){
-            continue;
+    for (const auto& mem : state->immutable) {
+        in_mem = mem->get(key, snapshot);
+        if (in_mem.has_value()){
+            return in_mem.value();
         }
-        for (int j = sstables_file.at(i).size()-1; j>=0; j--){
-            std::string path = path_control(i, j);
-            std::optional<Value> check = SSTable(path).get(key);
+    }
+
+    // the files of this version stay on disk until we drop it
+    const std::shared_ptr<const Version>& version = state->version;
+    for (int i = 0; i <= version->max_level(); i++){
+        const auto& files = version->levels.at(i);
+        for (int j = files.size()-1; j>=0; j--){
+            const FileMeta& f = *files[j];
+            if (key < f.min || key > f.max){
+                continue;
+            }
+            std::optional<Value> check = table_cache.get(f.level, f.number, f.path)->get(key, snapshot);
             if (check.has_value()){
                 return check.value();
             }
@@ -33,264 +87,474 @@ Value DB::get(int key)
     return Value(false);
 }
 
+std::vector<Value> DB::multi_get(const std::vector<int>& keys)
+{
+    return multi_get(ReadOptions(), keys);
+}
 
-void DB::put(int key, Value val)
+std::vector<Value> DB::multi_get(const ReadOptions& options, const std::vector<int>& keys)
 {
-    mmt.add(key, val, seq);
-    seq++;
-    count+=1;
-    db_size += 1;
-    flush_check();
+    uint64_t snapshot = read_seq(options);
+    std::vector<int> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    std::vector<std::optional<Value>> found(sorted.size());
+
+    std::shared_ptr<const ReadState> state = load_read_state();
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        found[i] = state->active->get(sorted[i], snapshot);
+        for (auto it = state->immutable.begin(); it != state->immutable.end() && !found[i].has_value(); ++it)
+            found[i] = (*it)->get(sorted[i], snapshot);
+    }
+    const std::shared_ptr<const Version>& version = state->version;
+
+    // indexes into sorted that no newer source has answered yet, in key order
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        if (!found[i].has_value()) pending.push_back(i);
+
+    std::vector<int> file_keys;
+    std::vector<std::optional<Value>> file_found;
+    for (int i = 0; i <= version->max_level() && !pending.empty(); i++){
+        const auto& files = version->levels.at(i);
+        for (int j = files.size()-1; j >= 0 && !pending.empty(); j--){
+            const FileMeta& f = *files[j];
+            auto first = std::lower_bound(pending.begin(), pending.end(), f.min,
+                [&](size_t p, int k) { return sorted[p] < k; });
+            auto last = std::upper_bound(first, pending.end(), f.max,
+                [&](int k, size_t p) { return k < sorted[p]; });
+            if (first == last) continue;
+
+            file_keys.clear();
+            for (auto p = first; p != last; ++p) file_keys.push_back(sorted[*p]);
+            table_cache.get(f.level, f.number, f.path)->multi_get(file_keys, file_found, snapshot);
+            for (size_t k = 0; k < file_keys.size(); ++k)
+                if (file_found[k].has_value()) found[first[k]] = std::move(file_found[k]);
+            pending.erase(std::remove_if(first, last,
+                [&](size_t p) { return found[p].has_value(); }), last);
+        }
+    }
+
+    std::vector<Value> results;
+    results.reserve(keys.size());
+    for (int key : keys) {
+        size_t i = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+        results.push_back(found[i].has_value() ? found[i].value() : Value(false));
+    }
+    return results;
+}
+
+
+static std::string put_record(uint64_t seq, int key, const Value& val)
+{
+    std::string rec;
+    rec.push_back(static_cast<char>(wal::PUT));
+    table_format::put_fixed64(rec, seq);
+    table_format::put_fixed32(rec, static_cast<uint32_t>(key));
+    table_format::put_fixed16(rec, static_cast<uint16_t>(val.items.size()));
+    for (int item : val.items) table_format::put_fixed32(rec, static_cast<uint32_t>(item));
+    return rec;
 }
 
+static std::string delete_record(uint64_t seq, int key)
+{
+    std::string rec;
+    rec.push_back(static_cast<char>(wal::DELETE));
+    table_format::put_fixed64(rec, seq);
+    table_format::put_fixed32(rec, static_cast<uint32_t>(key));
+    return rec;
+}
+
+static std::string range_delete_record(uint64_t seq, int start, int end)
+{
+    std::string rec;
+    rec.push_back(static_cast<char>(wal::RANGE_DELETE));
+    table_format::put_fixed64(rec, seq);
+    table_format::put_fixed32(rec, static_cast<uint32_t>(start));
+    table_format::put_fixed32(rec, static_cast<uint32_t>(end));
+    return rec;
+}
 
-static bool entry_cmp(const Entry& a, const Entry& b) {
-    if (a.key != b.key) return a.key < b.key;          // key increase
-    return a.seq > b.seq;                              // seq decrease
+bool DB::put(int key, Value val)
+{
+    WriteBatch batch;
+    batch.put(key, val);
+    return write(batch);
 }
 
+
 static bool tomb_cmp(const RangeTomb& a, const RangeTomb& b) {
     if (a.start != b.start) return a.start < b.start; // start increase
     return a.seq > b.seq; 
 }
 
 
-static std::vector<Fragment> build_fragments(const std::vector<RangeTomb>& tombs) {
-    //  collect bond
-    std::set<int> bounds;
-    for (const auto& t : tombs) {
-        bounds.insert(t.start);
-        bounds.insert(t.end);
+// Entries of one MemTable, already encoded in its arena like SSTable
+// entries. The active MemTable keeps taking writes while it is walked, so
+// anything at or above the iterator's seq is skipped.
+class MemTableSource : public EntrySource
+{
+public:
+    MemTableSource(std::shared_ptr<MemTable> new_mem, uint64_t new_snapshot)
+    {
+        mem = std::move(new_mem);
+        snapshot = new_snapshot;
     }
 
-    std::vector<int> sorted_bounds(bounds.begin(), bounds.end());
-    std::vector<Fragment> fragments;
-
-    for (size_t i = 0; i + 1 < sorted_bounds.size(); ++i) {
-        int a = sorted_bounds[i];
-        int b = sorted_bounds[i + 1];
-
-        uint64_t max_seq = 0;
-        for (const auto& t : tombs) {
-            if (a >= t.start && b <= t.end) {
-                max_seq = std::max(max_seq, t.seq);
-            }
-        }
+    void seek_to_first() override
+    {
+        it = mem->iterator();
+        it.seek_to_first();
+        settle();
+    }
 
-        if (max_seq > 0) {
-            fragments.push_back(Fragment{a, b, max_seq});
-        }
+    void seek(int key) override
+    {
+        it = mem->iterator();
+        it.seek(key);
+        settle();
     }
 
-    return fragments;
-}
+    bool valid() const override { return it.valid(); }
+    const table_format::EntryView& view() const override { return current; }
 
-static bool is_key_covered_by_fragment(const std::vector<Fragment>& fragments, int key, uint64_t key_seq){
-    int left = 0, right = fragments.size() - 1;
+    void next() override
+    {
+        it.next();
+        settle();
+    }
 
-    while (left <= right) {
-        int mid = (left + right) / 2;
-        const Fragment& frag = fragments[mid];
+private:
+    std::shared_ptr<MemTable> mem;
+    uint64_t snapshot;
+    MemTable::Iterator it;
+    table_format::EntryView current;
 
-        if (key < frag.start) {
-            right = mid - 1;  // key in the left
-        } else if (key >= frag.end) {
-            left = mid + 1;   // key right
-        } else {
-            // key [frag.start, frag.end)
-            return frag.max_seq > key_seq;
-        }
+    void settle()
+    {
+        while (it.valid() && it.view().seq >= snapshot) it.next();
+        if (it.valid()) current = it.view();
     }
+};
 
-    return false;
+templatedb::DB::ReadView templatedb::DB::read_view(const ReadOptions& options)
+{
+    ReadView view;
+    view.seq = read_seq(options);
+    view.state = load_read_state();
+    return view;
 }
 
+std::unique_ptr<DB::Iterator> DB::new_iterator(int lower, int upper)
+{
+    return new_iterator(ReadOptions(), lower, upper);
+}
 
-std::vector<Value> DB::scan() {
-    std::vector<Value> result;
-    std::unordered_set<int> seen_keys;
+std::unique_ptr<DB::Iterator> DB::new_iterator(const ReadOptions& options, int lower, int upper)
+{
+    return new_iterator(read_view(options), lower, upper);
+}
 
-    // build fragments
+std::unique_ptr<DB::Iterator> DB::new_iterator(const ReadView& view, int lower, int upper)
+{
+    std::unique_ptr<Iterator> iter(new Iterator());
+    iter->lower = lower;
+    iter->upper = upper;
+    iter->snapshot = view.seq;
+    iter->version = view.state->version;
+    std::vector<std::unique_ptr<EntrySource>> sources;
     std::vector<RangeTomb> tombs;
-
-    mmt.reset_range_iterator();
-    while (mmt.range_tombs_has_next())
-        tombs.push_back(mmt.range_tombs_next().value());
-
-    std::vector<SSTable> sstables;
-    for (int i = 0; i <= max_level; ++i) {
-        for (int j = sstables_file[i].size() - 1; j >= 0; --j) {
-            std::string path = path_control(i, j);
-            sstables.emplace_back(path);
-            sstables.back().reset_range_iterator();
-            while (sstables.back().range_tombs_has_next())
-                tombs.push_back(sstables.back().range_tombs_next().value());
+    // [min, max] of a source against [lower, upper)
+    auto overlaps = [lower, upper](int min, int max) { return max >= lower && (min < upper || upper == INT32_MAX); };
+    auto in_range = [lower, upper](int start, int end) { return end > lower && (start < upper || upper == INT32_MAX); };
+    // a fragment at or above view.seq may hide tombstones the view does see,
+    // so then the source's raw tombstones below view.seq are used instead
+    auto add_fragments = [&](const std::vector<Fragment>& fragments, const auto& raw_tombs) {
+        bool newer = std::any_of(fragments.begin(), fragments.end(),
+            [&](const Fragment& f) { return f.max_seq >= view.seq; });
+        if (!newer) {
+            for (const auto& f : fragments)
+                if (in_range(f.start, f.end)) tombs.push_back(RangeTomb{f.start, f.end, f.max_seq});
+            return;
         }
-    }
-
-    std::vector<Fragment> fragments = build_fragments(tombs);
-
-    // iterator heap
-    struct Item {
-        Entry entry;
-        int source; // 0 = MemTable, 1~n = SSTable[i-1]
-    };
-
-    auto cmp = [](const Item& a, const Item& b) {
-        return a.entry.key > b.entry.key; // min-heap
+        for (const auto& t : raw_tombs())
+            if (t.seq < view.seq && in_range(t.start, t.end)) tombs.push_back(t);
     };
-
-    std::priority_queue<Item, std::vector<Item>, decltype(cmp)> pq(cmp);
-
-    mmt.reset_iterator();
-    std::vector<bool> is_mmt = {true};
-    if (mmt.has_next())
-        pq.push({mmt.next().value(), 0});
-
-    for (int i = 0; i < sstables.size(); ++i) {
-        sstables[i].reset_iterator();
-        is_mmt.push_back(false);
-        if (sstables[i].has_next())
-            pq.push({sstables[i].next().value(), i + 1});
+    // the active MemTable keeps taking writes; whatever it takes at or
+    // after view.seq is invisible anyway
+    std::vector<std::shared_ptr<MemTable>> mems = {view.state->active};
+    mems.insert(mems.end(), view.state->immutable.begin(), view.state->immutable.end());
+    for (const auto& mem : mems) {
+        if (!overlaps(mem->min, mem->max)) continue;
+        sources.push_back(std::make_unique<MemTableSource>(mem, view.seq));
+        add_fragments(mem->getFragments(), [&] { return mem->getRangeTomb(); });
     }
 
-    // heap merge
-    while (!pq.empty()) {
-        Item item = pq.top(); pq.pop();
-        Entry& e = item.entry;
-        int src = item.source;
-
-        if (seen_keys.count(e.key)) {
-            // skip remaining versions of the same key
-        } else {
-            seen_keys.insert(e.key);
-
-            if (!e.tomb && !is_key_covered_by_fragment(fragments, e.key, e.seq)) {
-                result.push_back(e.val);
-            }
+    // the pinned Version keeps these files on disk; the tables come opened
+    // from the table cache and each source walks one with its own cursor
+    const Version& version = *view.state->version;
+    for (int i = 0; i <= version.max_level(); ++i) {
+        for (int j = version.levels[i].size() - 1; j >= 0; --j) {
+            const FileMeta& f = *version.levels[i][j];
+            if (!overlaps(f.min, f.max)) continue;
+            std::shared_ptr<SSTable> table = table_cache.get(f.level, f.number, f.path);
+            add_fragments(table->getFragments(), [&]() -> const auto& { return table->getRangeTomb(); });
+            // a bounded scan reads a few blocks, readahead would waste I/O
+            sources.push_back(std::make_unique<TableSource>(table.get(), lower == INT32_MIN && upper == INT32_MAX));
+            iter->tables.push_back(std::move(table));
         }
+    }
+    // every source is already fragmented, merging those is cheaper than
+    // fragmenting all raw tombstones again
+    iter->fragments = build_fragments(tombs);
+    iter->merged = std::make_unique<MergingIterator>(std::move(sources));
+    return iter;
+}
 
-        // Push next
-        if (is_mmt[src]) {
-            if (mmt.has_next())
-                pq.push({mmt.next().value(), src});
-        } else {
-            if (sstables[src - 1].has_next())
-                pq.push({sstables[src - 1].next().value(), src});
-        }
+void DB::Iterator::seek_to_first()
+{
+    if (lower == INT32_MIN) {
+        merged->seek_to_first();
+        find_visible();
+    } else {
+        seek(lower);
     }
+}
 
-    return result;
+void DB::Iterator::seek(int key)
+{
+    merged->seek(std::max(key, lower));
+    find_visible();
 }
 
+bool DB::Iterator::valid() const
+{
+    return has_current;
+}
 
+void DB::Iterator::next()
+{
+    find_visible();
+}
 
+int DB::Iterator::key() const
+{
+    return current_key;
+}
 
-std::vector<Value> DB::scan(int min_key, int max_key) {
-    std::vector<Value> result;
-    std::unordered_set<int> seen_keys;
-    std::vector<RangeTomb> tombs;
+const Value &DB::Iterator::value() const
+{
+    return current_value;
+}
 
-    // build fragments
-    mmt.reset_range_iterator();
-    while (mmt.range_tombs_has_next())
-        tombs.push_back(mmt.range_tombs_next().value());
-
-    std::vector<SSTable> sstables;
-    for (int i = 0; i <= max_level; ++i) {
-        for (int j = sstables_file[i].size() - 1; j >= 0; --j) {
-            std::string path = path_control(i, j);
-            sstables.emplace_back(path);
-            sstables.back().reset_range_iterator();
-            while (sstables.back().range_tombs_has_next())
-                tombs.push_back(sstables.back().range_tombs_next().value());
+// Moves to the next key whose newest version is a live value. The merge
+// yields that version first; the older ones are skipped.
+void DB::Iterator::find_visible()
+{
+    has_current = false;
+    while (merged->valid() && !has_current) {
+        const table_format::EntryView& v = merged->view();
+        int key = v.key;
+        if (key >= upper && upper != INT32_MAX) return;
+        if (v.seq >= snapshot) {
+            // written after the iterator's view, an older version may follow
+            merged->next();
+            continue;
         }
+        if (!v.tomb && !is_key_covered_by_fragment(fragments, key, v.seq)) {
+            has_current = true;
+            current_key = key;
+            current_value = v.value();
+        }
+        while (merged->valid() && merged->view().key == key) merged->next();
     }
+}
 
-    std::vector<Fragment> fragments = build_fragments(tombs);
+std::vector<Value> DB::scan() {
+    return scan_range(ReadOptions(), INT32_MIN, INT32_MAX);
+}
 
-    // build iterator
-    struct Item {
-        Entry entry;
-        int source_id; // 0 = MemTable, 1~n = SSTable[i-1]
-    };
+std::vector<Value> DB::scan(int min_key, int max_key) {
+    return scan_range(ReadOptions(), min_key, max_key);
+}
+
+std::vector<Value> DB::scan(const ReadOptions& options, int min_key, int max_key) {
+    return scan_range(options, min_key, max_key);
+}
 
-    auto cmp = [](const Item& a, const Item& b) {
-        return a.entry.key > b.entry.key; // min-heap
+std::vector<Value> DB::scan_range(const ReadOptions& options, int min_key, int max_key) {
+    int threads = scan_threads;
+    ReadView view = read_view(options);
+
+    // split points: the smallest keys of the files inside the range, so the
+    // parts get roughly the same number of files to merge
+    std::vector<int> bounds;
+    for (const auto& level : view.state->version->levels)
+        for (const auto& f : level)
+            if (f->min > min_key && f->min < max_key) bounds.push_back(f->min);
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    int parts = std::min<int>(threads, bounds.size() + 1);
+
+    std::vector<int> cuts = {min_key};
+    for (int i = 1; i < parts; ++i)
+        cuts.push_back(bounds[bounds.size() * i / parts]);
+    cuts.push_back(max_key);
+
+    std::vector<std::vector<Value>> results(parts);
+    auto scan_part = [&](int i) {
+        std::unique_ptr<Iterator> it = new_iterator(view, cuts[i], cuts[i + 1]);
+        for (it->seek_to_first(); it->valid(); it->next())
+            results[i].push_back(it->value());
     };
-    std::priority_queue<Item, std::vector<Item>, decltype(cmp)> pq(cmp);
+    std::vector<std::thread> workers;
+    for (int i = 1; i < parts; ++i)
+        workers.emplace_back(scan_part, i);
+    scan_part(0);
+    for (auto& worker : workers)
+        worker.join();
+
+    std::vector<Value> result = std::move(results[0]);
+    for (int i = 1; i < parts; ++i)
+        result.insert(result.end(), std::make_move_iterator(results[i].begin()),
+            std::make_move_iterator(results[i].end()));
+    return result;
+}
 
-    mmt.reset_iterator();
-    std::vector<bool> is_mmt = {true};
-    if (mmt.has_next())
-        pq.push({mmt.next().value(), 0});
 
-    for (int i = 0; i < sstables.size(); ++i) {
-        sstables[i].reset_iterator();
-        is_mmt.push_back(false);
-        if (sstables[i].has_next())
-            pq.push({sstables[i].next().value(), i + 1});
-    }
 
-    // Scan and merge, and filter the valid values within the range of min_key to max_key
-    while (!pq.empty()) {
-        Item item = pq.top(); pq.pop();
-        Entry& e = item.entry;
-        int src = item.source_id;
 
-        // right bond
-        if (e.key >= max_key)
-            break;
+bool DB::del(int key)
+{
+    WriteBatch batch;
+    batch.del(key);
+    return write(batch);
+}
 
-        // left bond
-        if (e.key < min_key) {
-            // no count for search newer version
-        } else if (!seen_keys.count(e.key)) {
-            seen_keys.insert(e.key);
+// delte from [min,max), notice not [4,6]!!!!
+bool DB::del(int min_key, int max_key)
+{
+    WriteBatch batch;
+    batch.del(min_key, max_key);
+    return write(batch);
+}
 
-            if (!e.tomb && !is_key_covered_by_fragment(fragments, e.key, e.seq)) {
-                result.push_back(e.val);
-            }
-        }
+// a group stops growing past this many bytes of ops, and a small first batch
+// only takes a little company, so its writer is not held up for long
+static const size_t MAX_GROUP_SIZE = 1 << 20;
+static const size_t SMALL_BATCH_SIZE = 128 << 10;
+
+// Writers queue up and the one at the front leads: it takes the batches
+// queued behind it as one group, assigns their seqs, and appends the group to
+// the log and inserts it into the MemTable without the lock. Only the leader
+// touches the log and the active MemTable, so readers never wait on it, and
+// one log append and sync serve the whole group.
+bool DB::write(const WriteBatch& batch)
+{
+    if (batch.empty()) return true;
+    Writer w;
+    w.batch = &batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    enter_writers(w, lock);
+    if (w.done) return w.ok;
+    if (bg_error) {
+        leave_writers();
+        return false;
+    }
 
-        // iterator
-        if (is_mmt[src]) {
-            if (mmt.has_next())
-                pq.push({mmt.next().value(), src});
-        } else {
-            if (sstables[src - 1].has_next())
-                pq.push({sstables[src - 1].next().value(), src});
+    const WriteBatch* group = &batch;
+    WriteBatch merged;
+    size_t members = 1;
+    size_t max_size = batch.byte_size() <= SMALL_BATCH_SIZE ? batch.byte_size() + SMALL_BATCH_SIZE : MAX_GROUP_SIZE;
+    size_t size = batch.byte_size();
+    for (auto it = writers.begin() + 1; it != writers.end() && (*it)->batch; ++it, ++members) {
+        size += (*it)->batch->byte_size();
+        if (size > max_size) break;
+        if (group == &batch) {
+            merged.append(batch);
+            group = &merged;
         }
+        merged.append(*(*it)->batch);
     }
-
-    return result;
+    uint64_t first = seq;
+    seq += group->count();
+    std::shared_ptr<MemTable> mem = mmt;
+    std::shared_ptr<LogWriter> writer = wal != WAL_DISABLED ? log : nullptr;
+    lock.unlock();
+
+    // a group that did not reach the log is not applied, since a restart
+    // could not bring it back
+    bool logged = true;
+    if (writer) {
+        uint64_t offset = writer->add_record(group->record(first));
+        logged = offset != 0 && sync_log(writer, offset);
+    }
+    if (logged)
+        group->insert_into(first, *mem);
+
+    lock.lock();
+    if (logged) {
+        count += group->count();
+        db_size += group->count();
+        visible_seq.store(first + group->count(), std::memory_order_release);
+    } else {
+        // a torn record would hide every later one from replay
+        set_bg_error("Refusing writes after a failed log write");
+    }
+    for (size_t i = 1; i < members; ++i) {
+        Writer* follower = writers[1];
+        writers.erase(writers.begin() + 1);
+        follower->done = true;
+        follower->ok = logged;
+        follower->cv.notify_one();
+    }
+    // still at the front, so no other leader writes while this one stalls
+    flush_check(lock);
+    leave_writers();
+    return logged;
 }
 
+// Queues w and waits until it is at the front of the writer queue (or its
+// batch was committed by a group). At the front nobody else appends to the
+// log or inserts into mmt, so it may also switch the MemTable. Caller holds
+// the lock.
+void DB::enter_writers(Writer& w, std::unique_lock<std::mutex>& lock)
+{
+    writers.push_back(&w);
+    while (!w.done && writers.front() != &w)
+        w.cv.wait(lock);
+}
 
+void DB::leave_writers()
+{
+    writers.pop_front();
+    if (!writers.empty())
+        writers.front()->cv.notify_one();
+}
 
-
-void DB::del(int key)
+const Snapshot* DB::get_snapshot()
 {
-    mmt.point_delete(key, seq);
-    seq++;
-    count += 1;
-    db_size += 1;
-    flush_check();
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t at = visible_seq.load(std::memory_order_acquire);
+    snapshots.insert(at);
+    return new Snapshot(at);
 }
 
-// delte from [min,max), notice not [4,6]!!!!
-void DB::del(int min_key, int max_key)
+void DB::release_snapshot(const Snapshot* snapshot)
 {
-    mmt.range_delete(min_key, max_key, seq);
-    seq++;
-    count += 1;
-    db_size += 1;
-    flush_check();
+    if (snapshot == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = snapshots.find(snapshot->seq());
+        if (it != snapshots.end()) snapshots.erase(it);
+    }
+    delete snapshot;
 }
 
 
 size_t DB::size()
 {
+    std::lock_guard<std::mutex> lock(mutex);
     return db_size;
 }
 
@@ -323,6 +587,9 @@ std::vector<Value> DB::execute_op(Operation op)
 }
 
 
+// rows per WriteBatch when loading a data file
+static const uint32_t LOAD_BATCH = 1000;
+
 bool DB::load_data_file(std::string & fname)
 {
     std::ifstream fid(fname);
@@ -331,6 +598,7 @@ bool DB::load_data_file(std::string & fname)
         int key;
         int line_num = 0;
         std::string line;
+        WriteBatch batch;
         std::getline(fid, line); // First line is rows, col
         while (std::getline(fid, line))
         {
@@ -343,13 +611,18 @@ bool DB::load_data_file(std::string & fname)
 
             std::getline(linestream, item, ' ');
             key = stoi(item);
-            std::vector<int> items;
+            Items items;
             while(std::getline(linestream, item, ' '))
             {
                 items.push_back(stoi(item));
             }
-            this->put(key, Value(items));
+            batch.put(key, Value(std::move(items)));
+            if (batch.count() == LOAD_BATCH) {
+                this->write(batch);
+                batch.clear();
+            }
         }
+        this->write(batch);
     }
     else
     {
@@ -362,6 +635,8 @@ bool DB::load_data_file(std::string & fname)
 
 db_status DB::open(std::string & fname)
 {
+    if (std::filesystem::is_directory(fname))
+        return open_dir(fname);
     this->file.open(fname, std::ios::in | std::ios::out);
     if (file.is_open())
     {
@@ -372,6 +647,7 @@ db_status DB::open(std::string & fname)
 
         int key;
         std::string line;
+        WriteBatch batch;
         std::getline(file, line); // First line is rows, col
         while (std::getline(file, line))
         {
@@ -380,15 +656,20 @@ db_status DB::open(std::string & fname)
 
             std::getline(linestream, item, ',');
             key = stoi(item);
-            std::vector<int> items;
+            Items items;
             while(std::getline(linestream, item, ','))
             {
                 items.push_back(stoi(item));
             }
-            this->put(key, Value(items));
             if (value_dimensions == 0)
                 value_dimensions = items.size();
+            batch.put(key, Value(std::move(items)));
+            if (batch.count() == LOAD_BATCH) {
+                this->write(batch);
+                batch.clear();
+            }
         }
+        this->write(batch);
     }
     else if (!file) // File does not exist
     {
@@ -407,6 +688,30 @@ db_status DB::open(std::string & fname)
 
 bool DB::close()
 {
+    if (flush_thread.joinable())
+    {
+        // a persistent DB leaves nothing behind in memory
+        if (manifest)
+            flush();
+        // the flush thread drains the immutable MemTables before it exits,
+        // compaction workers finish the compaction they are running
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shutting_down = true;
+        }
+        bg_cv.notify_all();
+        flush_thread.join();
+        compaction_cv.notify_all();
+        for (auto& worker : compaction_workers)
+            worker.join();
+        compaction_workers.clear();
+        wal_cv.notify_all();
+        if (wal_sync_thread.joinable())
+            wal_sync_thread.join();
+        // the active MemTable is not flushed, its log brings it back on restart
+        if (log)
+            log->sync();
+    }
     if (file.is_open())
     {
         // this->write_to_file();
@@ -438,112 +743,869 @@ bool DB::close()
 // }
 
 
+// Hands the active MemTable to the flush thread and waits until everything
+// written so far is on disk.
 void templatedb::DB::flush()
 {
-    int sst_num = sstables_file.at(0).size();
-    std::string path = path_control(0, sst_num);
-    sstables_file.at(0).push_back(sst_num); // Add file's num
-    mmt.flush(path);
-    levels_size.at(0) += flush_base;
-    if (levels_size.at(0) >= level_size_base){
-        compact(0);
+    // queued like a write, so no leader is inserting into mmt while it moves
+    Writer w;
+    std::unique_lock<std::mutex> lock(mutex);
+    enter_writers(w, lock);
+    if (mmt->size > 0 && !bg_error) {
+        done_cv.wait(lock, [this]{ return imm.size() < static_cast<size_t>(max_immutable) || bg_error; });
+        if (!bg_error)
+            switch_memtable();
     }
+    leave_writers();
+    done_cv.wait(lock, [this]{ return imm.empty() || bg_error; });
 }
 
-bool templatedb::DB::flush_check()
+bool templatedb::DB::flush_check(std::unique_lock<std::mutex>& lock)
 {
-    if (count >= flush_base){
-        flush();
-        count = 0;
-        mmt.clear();
-        return true;
+    bool switched = false;
+    // nothing is flushed after an error, so the active MemTable just grows
+    while (memtable_full() && !bg_error){
+        if (imm.size() >= static_cast<size_t>(max_immutable)) {
+            // too many MemTables waiting for the flush thread: stall this writer
+            done_cv.wait(lock);
+            continue;
+        }
+        switch_memtable();
+        switched = true;
     }
-    return false;
+    return switched;
 }
 
-void templatedb::DB::compact(int level) {
-    int this_level_size = levels_size.at(level);
+// With a write buffer size the arena footprint decides, otherwise the op
+// count. Caller holds the lock.
+bool templatedb::DB::memtable_full() const
+{
+    if (write_buffer_size > 0)
+        return mmt->size > 0 && mmt->memory_usage() >= write_buffer_size;
+    return count >= flush_base;
+}
 
-    // Todo: tiering, compact this to next level
-    std::vector<Entry> entries;
-    std::vector<RangeTomb> tombs;
+// Moves the active MemTable into the immutable queue. Caller holds the lock.
+void templatedb::DB::switch_memtable()
+{
+    // sorted here so the flush thread and readers never mutate it
+    mmt->sort_tombs();
+    imm.push_back(mmt);
+    imm_logs.push_back(log);
+    mmt = std::make_shared<MemTable>();
+    install_read_state();
+    if (log)
+        log = wal != WAL_DISABLED ? LogWriter::open(log_path(next_file_number++)) : nullptr;
+    count = 0;
+    bg_cv.notify_one();
+}
 
-    int last_idx = sstables_file.at(level).size() - 1;
-    std::string file_path = path_control(level, sstables_file.at(level).at(last_idx));
-    SSTable sst(file_path);
-    uint64_t new_seq_start = sst.get_seq_start();
-    int min = sst.get_min(), max = sst.get_max();
-    // std::cout << "file path" << file_path<<"\n";
-    for (const auto& e: sst.getEntries()){
-        // std::cout << "insert " << e.key << "\n";
-        entries.push_back(e);
-    }
-    for (const auto& e: sst.getRangeTomb()){
-        // std::cout << "inser range tombs"<< e.seq <<"\n";
-        tombs.push_back(e);
-    } 
-
-    for (int i = sstables_file.at(level).size() - 2; i >= 0; i--){
-        std::string path = path_control(level, sstables_file.at(level).at(i));
-        // std::cout << "file path" << path<<"\n";
-        SSTable new_sst(path);
-        min = std::min(new_sst.get_min(), min);
-        max = std::max(new_sst.get_max(), max);
-        new_seq_start = std::min(new_seq_start, new_sst.get_seq_start());
-        for (const auto& e: new_sst.getEntries()){
-            // std::cout << "insert " << e.key << "\n";
-            entries.push_back(e);
+void templatedb::DB::flush_worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        bg_cv.wait(lock, [this]{ return shutting_down || (!imm.empty() && !bg_error); });
+        if (imm.empty() || bg_error) break; // shutting down and drained, or stopped by an error
+
+        std::shared_ptr<MemTable> table = imm.front();
+        uint64_t sst_num = next_file_number++;
+        std::string path = path_control(0, sst_num);
+        int bits_per_key = bloom_bits_per_key;
+        table_format::Compression compression = level_compression(0);
+        std::shared_ptr<LogWriter> table_log = imm_logs.front();
+        // the table must be durable before its log goes or the MANIFEST names it
+        bool sync_table = table_log || manifest;
+
+        // readers keep finding the data in imm until the file is installed
+        lock.unlock();
+        bool saved = table->save(path, bits_per_key, compression) && (!sync_table || sync_file(path));
+        lock.lock();
+        if (!saved) {
+            std::remove(path.c_str());
+            set_bg_error("Unable to write " + path);
+            break;
         }
-        for (const auto& e: new_sst.getRangeTomb()){
-            // std::cout << "inser range tombs"<< e.seq <<"\n";
-            tombs.push_back(e);
-        } 
-    }
-    // std::cout << "tomb size"<< tombs.size()<< "\n";
-    // std::cout << "entries size"<< tombs.size()<< "\n";
-    // std::cout << "sstables_file size"<< sstables_file.size()<< "\n";
-    // std::cout << "sstables_file size"<< sstables_file.at(level).size()<< "\n";
-    // std::cout << "sstables_file 0 0:"<< sstables_file.at(level).at(0)<< "\n";
-    // std::cout << "sstables_file 0 1:"<< sstables_file.at(level).at(1)<< "\n";
-    std::sort(entries.begin(), entries.end(), entry_cmp);
-    std::sort(tombs.begin(), tombs.end(), tomb_cmp);
-    MemTable svae_mmt(entries, tombs, min, max, levels_size.at(level), new_seq_start);
-
-    for (int file_num : sstables_file.at(level)) {
-        std::string old_path = path_control(level, file_num);
-        std::remove(old_path.c_str());
-    }
-    levels_size.at(level) = 0;
-    sstables_file.at(level).clear();
-    int new_level = level + 1;
-    if (new_level <= max_level){
-        levels_size.at(new_level) += this_level_size;
-        svae_mmt.save(path_control(new_level, sstables_file.at(new_level).size()));
-        sstables_file.at(new_level).push_back(sstables_file.at(new_level).size());
-        if (levels_size.at(new_level) >= level_size_base * pow(level_size_multi, new_level)){
-            compact(new_level);
+
+        auto version = std::make_shared<Version>(*current);
+        auto meta = std::make_shared<FileMeta>(
+            0, sst_num, path, table->min, table->max, table->size, &table_cache);
+        meta->smallest_seq = table->seq_start;
+        meta->largest_seq = table->seq_end;
+        std::error_code ec;
+        meta->file_size = std::filesystem::file_size(path, ec);
+        meta->deletions = table->deletions;
+        version->levels.at(0).push_back(meta);
+        VersionEdit edit;
+        edit.add_file(*meta);
+        if (!log_edit(edit, *version)) {
+            meta->obsolete = true; // removes the table once meta goes
+            set_bg_error("Unable to record " + path);
+            break;
         }
+        current = version;
+        imm.pop_front();
+        imm_logs.pop_front();
+        install_read_state();
+        if (table_log)
+            std::remove(table_log->path().c_str());
+        done_cv.notify_all();
+        compaction_cv.notify_one();
+    }
+}
+
+// Stops writes, flushes and compactions for good and wakes everyone waiting
+// on them. Caller holds the lock.
+void templatedb::DB::set_bg_error(const std::string& message)
+{
+    std::cerr << message << std::endl;
+    bg_error = true;
+    done_cv.notify_all();
+    compaction_cv.notify_all();
+}
+
+void templatedb::DB::wal_sync_worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!shutting_down && wal == WAL_SYNC_INTERVAL) {
+        wal_cv.wait_for(lock, std::chrono::milliseconds(wal_sync_interval_ms));
+        std::shared_ptr<LogWriter> writer = log;
+        lock.unlock();
+        if (writer)
+            writer->sync();
+        lock.lock();
+    }
+}
+
+// Called without the lock, so writers that arrive together share one sync.
+bool templatedb::DB::sync_log(const std::shared_ptr<LogWriter>& writer, uint64_t offset)
+{
+    if (!writer || offset == 0 || wal != WAL_SYNC_EVERY_WRITE) return true;
+    if (!writer->sync_to(offset)) {
+        std::cerr << "Unable to sync log " << writer->path() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Applies a logged write to the active MemTable. Caller holds the lock.
+void templatedb::DB::apply_record(const char* data, size_t n)
+{
+    const size_t header = 1 + 8 + 4;
+    if (n < header) return;
+    uint8_t type = static_cast<uint8_t>(data[0]);
+    uint64_t rec_seq = table_format::get_fixed64(data + 1);
+    if (type == wal::BATCH) {
+        uint32_t ops = WriteBatch::apply(data, n, *mmt);
+        if (ops == 0) return;
+        seq = std::max(seq, rec_seq + ops);
+        count += ops;
+        db_size += ops;
+        return;
+    }
+    int key = static_cast<int>(table_format::get_fixed32(data + 9));
+    if (type == wal::PUT && n >= header + 2) {
+        uint16_t dims = table_format::get_fixed16(data + header);
+        if (n < header + 2 + 4 * static_cast<size_t>(dims)) return;
+        Value val;
+        val.items.resize(dims);
+        for (uint16_t i = 0; i < dims; ++i)
+            val.items[i] = static_cast<int>(table_format::get_fixed32(data + header + 2 + 4 * i));
+        mmt->add(key, val, rec_seq);
+    } else if (type == wal::DELETE) {
+        mmt->point_delete(key, rec_seq);
+    } else if (type == wal::RANGE_DELETE && n >= header + 4) {
+        mmt->range_delete(key, static_cast<int>(table_format::get_fixed32(data + header)), rec_seq);
     } else {
-        levels_size.push_back(this_level_size);
-        svae_mmt.save(path_control(new_level, 0));
-        sstables_file.push_back(std::vector{0});
-        max_level += 1;
+        return;
+    }
+    seq = std::max(seq, rec_seq + 1);
+    count += 1;
+    db_size += 1;
+}
+
+// Replays every log left in the directory into the active MemTable, then
+// rewrites the MemTable into a fresh log so the old ones can go. Caller
+// holds the lock.
+void templatedb::DB::replay_logs()
+{
+    std::vector<std::pair<uint64_t, std::string>> old_logs;
+    std::string dir = std::filesystem::path(log_path(0)).parent_path().string();
+    std::error_code ec;
+    for (const auto& f : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = f.path().filename().string();
+        if (name.rfind("WAL_", 0) != 0 || f.path().extension() != ".log") continue;
+        char* end = nullptr;
+        uint64_t num = std::strtoull(name.c_str() + 4, &end, 10);
+        if (end == name.c_str() + 4 || std::string(end) != ".log") continue;
+        // still covering an immutable MemTable of this run
+        bool owned = false;
+        for (const auto& l : imm_logs)
+            owned = owned || (l && l->path() == f.path().string());
+        if (owned) continue;
+        old_logs.push_back({num, f.path().string()});
+        next_file_number = std::max(next_file_number, num + 1);
+    }
+    std::sort(old_logs.begin(), old_logs.end());
+    for (const auto& [num, path] : old_logs)
+        LogReader::replay(path, [this](const char* data, size_t n) { apply_record(data, n); });
+
+    log = LogWriter::open(log_path(next_file_number++));
+    if (!log) return;
+    for (const auto& e : mmt->getEntries())
+        log->add_record(e.tomb ? delete_record(e.seq, e.key) : put_record(e.seq, e.key, e.val));
+    for (const auto& t : mmt->getRangeTomb())
+        log->add_record(range_delete_record(t.seq, t.start, t.end));
+    if (!log->sync()) return;
+    for (const auto& [num, path] : old_logs)
+        std::remove(path.c_str());
+}
+
+db_status templatedb::DB::open_dir(const std::string& dir)
+{
+    // replaces the MemTable and the log, so no leader may be writing
+    Writer w;
+    std::unique_lock<std::mutex> lock(mutex);
+    enter_writers(w, lock);
+    db_dir = dir;
+    while (db_dir.size() > 1 && db_dir.back() == '/')
+        db_dir.pop_back();
+    if (!recover()) {
+        leave_writers();
+        this->status = ERROR_OPEN;
+        return this->status;
+    }
+    replay_logs();
+    visible_seq = seq;
+    flush_check(lock);
+    leave_writers();
+    compaction_cv.notify_all();
+    this->status = OPEN;
+    return this->status;
+}
+
+// Rebuilds the file set from the MANIFEST named by CURRENT, removes files
+// that no edit mentions (outputs of an interrupted flush or compaction) and
+// starts a fresh MANIFEST holding a single snapshot. A directory without
+// CURRENT predates the MANIFEST, so its tables are adopted instead. Caller
+// holds the lock.
+bool templatedb::DB::recover()
+{
+    std::map<uint64_t, std::shared_ptr<FileMeta>> files; // by number, i.e. oldest first
+    std::string manifest_name;
+    std::ifstream current_file(db_dir + "/CURRENT");
+    if (current_file && std::getline(current_file, manifest_name) && !manifest_name.empty()) {
+        std::string manifest_file = db_dir + "/" + manifest_name;
+        if (!std::filesystem::exists(manifest_file)) {
+            std::cerr << "Missing " << manifest_file << std::endl;
+            return false;
+        }
+        bool ok = true;
+        // a torn last edit never took effect, so a damaged tail is ignored
+        LogReader::replay(manifest_file, [&](const char* data, size_t n) {
+            VersionEdit edit;
+            if (!ok || !edit.decode(data, n)) {
+                ok = false;
+                return;
+            }
+            for (const auto& [level, number] : edit.removed)
+                files.erase(number);
+            for (const auto& f : edit.added) {
+                auto meta = std::make_shared<FileMeta>(f.level, f.number,
+                    path_control(f.level, f.number), f.min, f.max, f.size, &table_cache);
+                meta->smallest_seq = f.smallest_seq;
+                meta->largest_seq = f.largest_seq;
+                meta->file_size = f.file_size;
+                meta->deletions = f.deletions;
+                files[f.number] = meta;
+            }
+            next_file_number = std::max(next_file_number, edit.next_file_number);
+            seq = std::max(seq, edit.last_seq);
+        });
+        if (!ok) {
+            std::cerr << "Unable to decode " << manifest_file << std::endl;
+            return false;
+        }
+    } else if (!adopt_tables(files)) {
+        return false;
+    }
+
+    auto version = std::make_shared<Version>();
+    version->levels.push_back({});
+    for (const auto& [number, f] : files) {
+        if (!std::filesystem::exists(f->path)) {
+            std::cerr << "Missing " << f->path << std::endl;
+            return false;
+        }
+        while (version->max_level() < f->level)
+            version->levels.push_back({});
+        version->levels[f->level].push_back(f);
+    }
+    compacting.assign(version->levels.size(), false);
+    current = version;
+    install_read_state();
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(db_dir, ec)) {
+        std::string name = entry.path().filename().string();
+        bool orphan = name == "CURRENT.tmp" || (name.rfind("MANIFEST-", 0) == 0 && name != manifest_name);
+        if (name.rfind("SSTable_", 0) == 0) {
+            size_t sep = name.find('_', 8);
+            uint64_t number = sep == std::string::npos ? 0 : std::strtoull(name.c_str() + sep + 1, nullptr, 10);
+            orphan = files.count(number) == 0 || files[number]->path != entry.path().string();
+        }
+        if (orphan)
+            std::filesystem::remove(entry.path(), ec);
+    }
+    if (!write_manifest(*version))
+        return false;
+    if (!manifest_name.empty())
+        std::filesystem::remove(db_dir + "/" + manifest_name, ec);
+    return true;
+}
+
+// Takes every SSTable of a directory written before the MANIFEST into L0,
+// oldest first. Their names number tables per level, so each is renamed to
+// a fresh file number; compaction then moves them down. Caller holds the
+// lock.
+bool templatedb::DB::adopt_tables(std::map<uint64_t, std::shared_ptr<FileMeta>>& files)
+{
+    std::vector<std::pair<VersionEdit::NewFile, std::string>> found;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(db_dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("SSTable_", 0) != 0) continue;
+        size_t sep = name.find('_', 8);
+        if (sep != std::string::npos)
+            next_file_number = std::max<uint64_t>(next_file_number, std::strtoull(name.c_str() + sep + 1, nullptr, 10) + 1);
+
+        SSTable table(entry.path().string());
+        VersionEdit::NewFile f{};
+        f.min = table.get_min();
+        f.max = table.get_max();
+        f.smallest_seq = f.largest_seq = table.get_seq_start();
+        SSTable::Cursor cursor(&table);
+        while (auto v = cursor.next_view()) {
+            f.size++;
+            f.deletions += v->tomb ? 1 : 0;
+            f.largest_seq = std::max(f.largest_seq, v->seq);
+        }
+        table.reset_range_iterator();
+        while (auto r = table.range_tombs_next()) {
+            f.size++;
+            f.deletions++;
+            f.largest_seq = std::max(f.largest_seq, r->seq);
+        }
+        if (f.size == 0) continue;
+        f.file_size = entry.file_size(ec);
+        seq = std::max(seq, f.largest_seq + 1);
+        found.push_back({f, entry.path().string()});
+    }
+
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+        return a.first.largest_seq < b.first.largest_seq;
+    });
+    for (auto& [f, old_path] : found) {
+        f.number = next_file_number++;
+        std::string path = path_control(0, f.number);
+        std::filesystem::rename(old_path, path, ec);
+        if (ec) {
+            std::cerr << "Unable to adopt " << old_path << std::endl;
+            return false;
+        }
+        auto meta = std::make_shared<FileMeta>(0, f.number, path, f.min, f.max, f.size, &table_cache);
+        meta->smallest_seq = f.smallest_seq;
+        meta->largest_seq = f.largest_seq;
+        meta->file_size = f.file_size;
+        meta->deletions = f.deletions;
+        files[f.number] = meta;
+    }
+    return true;
+}
+
+// Starts a new MANIFEST with one snapshot edit of the version and points
+// CURRENT at it. CURRENT is replaced by a rename, so a crash leaves either
+// the old or the new MANIFEST in charge. Caller holds the lock.
+bool templatedb::DB::write_manifest(const Version& version)
+{
+    std::string name = "MANIFEST-" + std::to_string(next_file_number++);
+    std::unique_ptr<LogWriter> writer = LogWriter::open(db_dir + "/" + name);
+    if (!writer) return false;
+
+    VersionEdit snapshot;
+    for (const auto& level : version.levels)
+        for (const auto& f : level)
+            snapshot.add_file(*f);
+    snapshot.next_file_number = next_file_number;
+    snapshot.last_seq = seq;
+    std::string rec;
+    snapshot.encode(rec);
+    if (writer->add_record(rec) == 0 || !writer->sync()) return false;
+
+    std::string tmp = db_dir + "/CURRENT.tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << name << "\n";
+        if (!out) return false;
+    }
+    if (!sync_file(tmp) || std::rename(tmp.c_str(), (db_dir + "/CURRENT").c_str()) != 0) {
+        std::cerr << "Unable to install " << name << std::endl;
+        return false;
+    }
+    sync_file(db_dir);
+    if (manifest)
+        std::remove(manifest->path().c_str());
+    manifest = std::move(writer);
+    return true;
+}
+
+// Makes the edit durable before next becomes the current version. A large
+// MANIFEST is replaced by a snapshot of next instead. Caller holds the lock.
+bool templatedb::DB::log_edit(VersionEdit& edit, const Version& next)
+{
+    const uint64_t MAX_MANIFEST_SIZE = 4 << 20;
+    if (!manifest) return true;
+    if (manifest->size() >= MAX_MANIFEST_SIZE)
+        return write_manifest(next);
+    edit.next_file_number = next_file_number;
+    edit.last_seq = seq;
+    std::string rec;
+    edit.encode(rec);
+    if (manifest->add_record(rec) == 0 || !manifest->sync()) {
+        std::cerr << "Unable to write " << manifest->path() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string templatedb::DB::log_path(uint64_t num){
+    return db_dir + "/WAL_" + std::to_string(num) + ".log";
+}
+
+// Bytes on disk once set_level_bytes is on, entries otherwise. Caller
+// holds the lock.
+uint64_t templatedb::DB::level_size(int level) const
+{
+    uint64_t size = 0;
+    for (const auto& f : current->levels.at(level))
+        size += level_bytes_base > 0 ? f->file_size : f->size;
+    return size;
+}
+
+double templatedb::DB::level_target(int level) const
+{
+    double base = level_bytes_base > 0 ? level_bytes_base : level_size_base;
+    int last = current->max_level();
+    // level 0 fills with flushes and the last level sets the sizes of the
+    // ones between, so only those two keep the static target
+    if (!dynamic_level_bytes || level == 0 || level >= last)
+        return base * pow(level_size_multi, level);
+    return std::max(base, level_size(last) / pow(level_size_multi, last - level));
+}
+
+table_format::Compression templatedb::DB::level_compression(int level) const
+{
+    if (compression_per_level.empty()) return table_format::NO_COMPRESSION;
+    return compression_per_level[std::min<size_t>(level, compression_per_level.size() - 1)];
+}
+
+double templatedb::DB::level_score(int level) const
+{
+    return level_size(level) / level_target(level);
+}
+
+// Plans a compaction for the level with the highest score (size over
+// target) of at least 1.0, trying the next one down when the policy has
+// nothing to do there or an in-flight compaction holds its input or output
+// level. Empty when no level is due. Caller holds the lock.
+Compaction templatedb::DB::pick_compaction()
+{
+    std::vector<std::pair<double, int>> due;
+    for (int level = 0; level <= current->max_level(); ++level) {
+        double score = level_score(level);
+        if (score >= 1.0 && !compacting.at(level)) due.push_back({score, level});
+    }
+    std::sort(due.rbegin(), due.rend());
+    for (const auto& [score, level] : due) {
+        uint64_t target_file_size = level_bytes_base > 0 ? level_bytes_base : level_size_base;
+        Compaction c = compaction_policy->plan(*current, level, target_file_size);
+        if (c.empty()) continue;
+        if (c.leveled && c.output_level < static_cast<int>(compacting.size())
+            && compacting[c.output_level]) continue;
+        return c;
+    }
+    return Compaction();
+}
+
+void templatedb::DB::compaction_worker(int id)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Compaction c;
+        compaction_cv.wait(lock, [&]{
+            if (shutting_down || id >= compaction_threads || bg_error) return true;
+            c = pick_compaction();
+            return !c.empty();
+        });
+        if (shutting_down || id >= compaction_threads || bg_error) break;
+
+        // a leveled output level gets files replaced, so it is claimed too
+        bool claim_output = c.leveled && c.output_level < static_cast<int>(compacting.size());
+        compacting.at(c.level) = true;
+        if (claim_output) compacting.at(c.output_level) = true;
+        compact(c, lock);
+        compacting.at(c.level) = false;
+        if (claim_output) compacting.at(c.output_level) = false;
+        // the next level may be due now, and this level can be picked again
+        compaction_cv.notify_all();
+    }
+}
+
+// Index of the oldest snapshot that can see seq, or snapshots.size() when
+// only the latest state can. Versions of a key in the same stripe are
+// indistinguishable to every reader, so only the newest of them is needed.
+static size_t snapshot_stripe(const std::vector<uint64_t>& snapshots, uint64_t seq) {
+    // a snapshot sees the seqs below its own
+    return std::upper_bound(snapshots.begin(), snapshots.end(), seq) - snapshots.begin();
+}
+
+// Merges the compaction's input files into output_level, dropping versions
+// no reader can see. Called with the lock held; the merge itself runs
+// unlocked, and the result is installed as a new Version in one step.
+void templatedb::DB::compact(const Compaction& c, std::unique_lock<std::mutex>& lock) {
+    std::vector<std::shared_ptr<FileMeta>> all_inputs = c.inputs;
+    all_inputs.insert(all_inputs.end(), c.next_inputs.begin(), c.next_inputs.end());
+    int min = INT32_MAX, max = INT32_MIN;
+    for (const auto& f : all_inputs) {
+        min = std::min(min, f->min);
+        max = std::max(max, f->max);
+    }
+    // nothing older lives below or beside the output, so deletes have
+    // nothing left to hide
+    bool bottom = true;
+    for (int i = c.output_level + 1; i <= current->max_level(); ++i)
+        bottom = bottom && current->levels[i].empty();
+    if (c.output_level <= current->max_level()) {
+        for (const auto& f : current->levels[c.output_level]) {
+            bool input = std::find(c.next_inputs.begin(), c.next_inputs.end(), f) != c.next_inputs.end();
+            bottom = bottom && (input || f->max < min || f->min > max);
+        }
+    }
+    int bits_per_key = bloom_bits_per_key;
+    bool mmap_inputs = use_mmap;
+    bool size_in_bytes = level_bytes_base > 0;
+    table_format::Compression compression = level_compression(c.output_level);
+    // sequence numbers that live snapshots read at, ascending; a snapshot
+    // taken later sees only the newest version of every input
+    std::vector<uint64_t> snapshots(this->snapshots.begin(), this->snapshots.end());
+    bool sync_output = manifest != nullptr;
+    lock.unlock();
+
+    std::vector<std::unique_ptr<SSTable>> tables;
+    std::vector<SSTable*> sources;
+    std::vector<RangeTomb> tombs;
+    for (const auto& f : all_inputs) {
+        tables.push_back(std::make_unique<SSTable>(f->path, mmap_inputs));
+        tables.back()->advise(MappedFile::SEQUENTIAL);
+        sources.push_back(tables.back().get());
+        for (const auto& t : tables.back()->getRangeTomb())
+            tombs.push_back(t);
+    }
+    std::sort(tombs.begin(), tombs.end(), tomb_cmp);
+    std::vector<Fragment> fragments = build_fragments(tombs);
+    // with snapshots the fragments cannot tell which range tombstone an old
+    // version still needs, so they are only dropped when there are none
+    bool keep_tombs = !bottom || !snapshots.empty();
+
+    struct Output {
+        std::shared_ptr<FileMeta> meta;
+        std::unique_ptr<TableBuilder> builder;
+        int lo; // first key this file is responsible for
+    };
+    std::vector<Output> outputs;
+    bool written = true;
+    auto open_output = [&](int lo) {
+        lock.lock();
+        uint64_t num = next_file_number++;
+        std::string path = path_control(c.output_level, num);
+        lock.unlock();
+        Output out;
+        out.meta = std::make_shared<FileMeta>(c.output_level, num, path, 0, 0, 0, &table_cache);
+        out.builder = std::make_unique<TableBuilder>(path, bits_per_key, compression);
+        out.lo = lo;
+        outputs.push_back(std::move(out));
+    };
+    // range tombstones are clipped to [lo, hi) of the file, so a leveled run
+    // stays non-overlapping while the gaps between its files remain covered
+    auto finish_output = [&](int hi, bool last) {
+        Output& out = outputs.back();
+        uint64_t kept = 0;
+        for (size_t i = 0; keep_tombs && i < tombs.size(); ++i) {
+            const RangeTomb& t = tombs[i];
+            int start = std::max(t.start, out.lo);
+            int end = last ? t.end : std::min(t.end, hi);
+            if (start < end) {
+                out.builder->add_tomb(RangeTomb{start, end, t.seq});
+                kept++;
+            }
+        }
+        out.meta->size = out.builder->num_entries() + kept;
+        out.meta->min = out.builder->min_key();
+        out.meta->max = out.builder->max_key();
+        out.meta->smallest_seq = out.builder->smallest_seq();
+        out.meta->largest_seq = out.builder->largest_seq();
+        out.meta->deletions = out.builder->num_deletions();
+        written = out.builder->finish() && written;
+        out.meta->file_size = out.builder->file_size();
+        out.builder.reset();
+        if (out.meta->size == 0) {
+            std::remove(out.meta->path.c_str());
+            outputs.pop_back();
+        } else if (sync_output) {
+            written = sync_file(out.meta->path) && written;
+        }
+    };
+
+    MergingIterator it(sources);
+    bool has_key = false, has_added = false;
+    int last_key = 0, last_added = 0;
+    size_t last_stripe = 0;
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        const table_format::EntryView& v = it.view();
+        if (!has_key || v.key != last_key) {
+            has_key = true;
+            last_key = v.key;
+            last_stripe = SIZE_MAX;
+        }
+        size_t stripe = snapshot_stripe(snapshots, v.seq);
+        if (stripe == last_stripe) continue; // shadowed by a newer version
+        last_stripe = stripe;
+
+        // a newer range tombstone in the same stripe hides this version and
+        // every older one from all readers
+        auto frag = std::upper_bound(fragments.begin(), fragments.end(), v.key,
+            [](int key, const Fragment& f) { return key < f.start; });
+        if (frag != fragments.begin() && v.key < (--frag)->end && frag->max_seq > v.seq
+            && snapshot_stripe(snapshots, frag->max_seq) == stripe) continue;
+        if (v.tomb && bottom && stripe == 0) continue;
+
+        // leveled outputs are cut at a key boundary once they are big enough
+        if (outputs.empty()) {
+            open_output(INT32_MIN);
+        } else if (c.target_file_size > 0 && has_added && v.key != last_added
+            && (size_in_bytes ? outputs.back().builder->file_size()
+                              : outputs.back().builder->num_entries()) >= c.target_file_size) {
+            finish_output(v.key, false);
+            open_output(v.key);
+        }
+        outputs.back().builder->add(v);
+        has_added = true;
+        last_added = v.key;
+    }
+    if (outputs.empty() && keep_tombs && !tombs.empty())
+        open_output(INT32_MIN);
+    if (!outputs.empty() && outputs.back().builder)
+        finish_output(INT32_MAX, true);
+    tables.clear();
+
+    lock.lock();
+    // on failure the inputs stay current and the outputs go with their metas
+    if (!written) {
+        for (const auto& out : outputs)
+            out.meta->obsolete = true;
+        set_bg_error("Unable to write the output of a level " + std::to_string(c.level) + " compaction");
+        return;
     }
+    // flushes and other compactions may have installed files meanwhile, so
+    // remove exactly our inputs and add the outputs after what is there
+    auto version = std::make_shared<Version>(*current);
+    VersionEdit edit;
+    auto remove_inputs = [&](int level, const std::vector<std::shared_ptr<FileMeta>>& inputs) {
+        auto& files = version->levels.at(level);
+        for (const auto& f : inputs) {
+            files.erase(std::find(files.begin(), files.end(), f));
+            edit.remove_file(*f);
+        }
+    };
+    if (c.output_level > version->max_level()){
+        version->levels.push_back({});
+        compacting.push_back(false);
+    }
+    remove_inputs(c.level, c.inputs);
+    remove_inputs(c.output_level, c.next_inputs);
+    for (const auto& out : outputs) {
+        version->levels.at(c.output_level).push_back(out.meta);
+        edit.add_file(*out.meta);
+    }
+    // inputs may only disappear from disk once the MANIFEST no longer needs them
+    if (!log_edit(edit, *version)) {
+        for (const auto& out : outputs)
+            out.meta->obsolete = true;
+        set_bg_error("Unable to record a level " + std::to_string(c.level) + " compaction");
+        return;
+    }
+    for (const auto& f : all_inputs)
+        f->obsolete = true;
+    current = version;
+    install_read_state();
 }
 
-std::string templatedb::DB::path_control(int level, int num)
+std::string templatedb::DB::path_control(int level, uint64_t num)
 {
-    return basic_path + std::to_string(level) + "_" + std::to_string(num) + ".data";
+    return db_dir + "/SSTable_" + std::to_string(level) + "_" + std::to_string(num) + ".data";
 }
 
 void templatedb::DB::set_flush(int num){
+    std::lock_guard<std::mutex> lock(mutex);
     flush_base = num;
 }
 
+// Resizes the compaction worker pool. Extra workers finish their current
+// compaction and exit.
+void templatedb::DB::set_compaction_threads(int num){
+    num = std::max(1, num);
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (shutting_down) return;
+        compaction_threads = num;
+        while ((int)compaction_workers.size() > num) {
+            retired.push_back(std::move(compaction_workers.back()));
+            compaction_workers.pop_back();
+        }
+    }
+    compaction_cv.notify_all();
+    for (auto& worker : retired)
+        worker.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = compaction_workers.size(); i < compaction_threads; ++i)
+        compaction_workers.emplace_back(&DB::compaction_worker, this, i);
+}
+
+void templatedb::DB::set_write_buffer_size(size_t bytes){
+    Writer w;
+    std::unique_lock<std::mutex> lock(mutex);
+    enter_writers(w, lock);
+    write_buffer_size = bytes;
+    flush_check(lock);
+    leave_writers();
+}
+
+void templatedb::DB::set_scan_threads(int num){
+    std::lock_guard<std::mutex> lock(mutex);
+    scan_threads = std::max(1, num);
+}
+
+void templatedb::DB::set_wal(wal_mode mode, int sync_interval_ms){
+    // replaying inserts into mmt and opens the log, so wait for the leaders
+    Writer w;
+    std::unique_lock<std::mutex> lock(mutex);
+    enter_writers(w, lock);
+    wal = mode;
+    wal_sync_interval_ms = std::max(1, sync_interval_ms);
+    if (mode != WAL_DISABLED && !log) {
+        replay_logs();
+        visible_seq = seq;
+        flush_check(lock);
+    }
+    leave_writers();
+    wal_cv.notify_all();
+    if (mode == WAL_SYNC_INTERVAL && !wal_sync_thread.joinable() && !shutting_down) {
+        wal_sync_thread = std::thread(&DB::wal_sync_worker, this);
+    } else if (mode != WAL_SYNC_INTERVAL && wal_sync_thread.joinable()) {
+        lock.unlock();
+        wal_sync_thread.join();
+    }
+}
+
+void templatedb::DB::set_max_immutable(int num){
+    std::lock_guard<std::mutex> lock(mutex);
+    max_immutable = std::max(1, num);
+}
+
 void templatedb::DB::set_level_size(int num){
+    std::lock_guard<std::mutex> lock(mutex);
     level_size_base = num;
+    compaction_cv.notify_all();
 }
 
 void templatedb::DB::set_level_size_multi(int num){
+    std::lock_guard<std::mutex> lock(mutex);
     level_size_multi = num;
+    compaction_cv.notify_all();
+}
+
+void templatedb::DB::set_level_bytes(uint64_t bytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    level_bytes_base = bytes;
+    compaction_cv.notify_all();
+}
+
+void templatedb::DB::set_dynamic_level_bytes(bool enable){
+    std::lock_guard<std::mutex> lock(mutex);
+    dynamic_level_bytes = enable;
+    compaction_cv.notify_all();
+}
+
+std::vector<LevelStats> templatedb::DB::get_level_stats(){
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<LevelStats> stats(current->levels.size());
+    for (int level = 0; level <= current->max_level(); ++level) {
+        LevelStats& s = stats[level];
+        for (const auto& f : current->levels[level]) {
+            s.files++;
+            s.bytes += f->file_size;
+            s.entries += f->size;
+            s.live_entries += f->size - std::min(f->size, f->deletions);
+        }
+        s.target = level_target(level);
+        s.score = level_score(level);
+    }
+    return stats;
+}
+
+void templatedb::DB::set_compression(const std::vector<table_format::Compression>& per_level){
+    std::lock_guard<std::mutex> lock(mutex);
+    compression_per_level = per_level;
+}
+
+const CompressionStats& templatedb::DB::get_compression_stats() const{
+    return compression_stats();
+}
+
+void templatedb::DB::set_compaction_policy(CompactionPolicy::Kind kind){
+    std::lock_guard<std::mutex> lock(mutex);
+    compaction_policy = CompactionPolicy::create(kind);
+    compaction_cv.notify_all();
+}
+
+void templatedb::DB::set_table_cache_size(int num){
+    table_cache.set_max_open_files(num);
+}
+
+void templatedb::DB::set_table_cache_memory(size_t bytes){
+    table_cache.set_memory_budget(bytes);
+}
+
+void templatedb::DB::set_bloom_bits(int bits_per_key){
+    std::lock_guard<std::mutex> lock(mutex);
+    bloom_bits_per_key = bits_per_key;
+}
+
+const FilterStats& templatedb::DB::get_filter_stats() const{
+    return SSTable::filter_stats();
+}
+
+void templatedb::DB::set_block_cache_size(size_t bytes){
+    BlockCache::instance().set_capacity(bytes);
+}
+
+const BlockCacheStats& templatedb::DB::get_block_cache_stats() const{
+    return BlockCache::instance().stats();
+}
+
+void templatedb::DB::set_mmap(bool enable){
+    std::lock_guard<std::mutex> lock(mutex);
+    use_mmap = enable;
+    table_cache.set_use_mmap(enable);
 }
\ No newline at end of file
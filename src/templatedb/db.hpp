@@ -8,10 +8,25 @@
 #include <sstream>
 #include <unordered_map>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <climits>
+#include <set>
 
 #include "operation.hpp"
 #include "SSTable.hpp"
 #include "MemTable.hpp"
+#include "TableCache.hpp"
+#include "Version.hpp"
+#include "CompactionPolicy.hpp"
+#include "WAL.hpp"
+#include "MergingIterator.hpp"
+#include "WriteBatch.hpp"
+#include "BlockCodec.hpp"
 #include "struct.hpp"
 
 namespace templatedb
@@ -24,6 +39,44 @@ typedef enum _status_code
     ERROR_OPEN = 100,
 } db_status;
 
+typedef enum _wal_mode
+{
+    WAL_DISABLED = 0,
+    WAL_NO_SYNC = 1,          // handed to the OS on every write, survives a process crash
+    WAL_SYNC_INTERVAL = 2,    // fdatasync every sync interval
+    WAL_SYNC_EVERY_WRITE = 3, // durable before the write returns, concurrent writers share a sync
+} wal_mode;
+
+// A point in the write history: reads at it see every write made before
+// DB::get_snapshot() and none made after. While it is held, compaction keeps
+// the versions it can see. Owned by the DB, freed by release_snapshot().
+class Snapshot
+{
+public:
+    uint64_t seq() const { return sequence; }
+
+private:
+    friend class DB;
+    explicit Snapshot(uint64_t s) : sequence(s) {}
+    uint64_t sequence; // writes below this seq are visible
+};
+
+struct ReadOptions
+{
+    const Snapshot* snapshot = nullptr; // nullptr reads the latest state
+};
+
+// One level as compaction sees it; sizes are totals over its files.
+struct LevelStats
+{
+    size_t files = 0;
+    uint64_t bytes = 0;        // on disk
+    uint64_t entries = 0;      // entries plus range tombstones
+    uint64_t live_entries = 0; // estimate: the entries that are not tombstones
+    double target = 0;         // in bytes or entries, whichever levels are measured in
+    double score = 0;          // size / target, compacted from 1.0 on
+};
+
 class DB
 {
 public:
@@ -31,15 +84,76 @@ public:
 
     DB();
     ~DB() {close();};
+    DB(const DB&) = delete;
+    DB& operator=(const DB&) = delete;
+
+    // Pull-based scan over the newest visible version of each key in
+    // [lower, upper), in key order; an upper of INT32_MAX means no bound.
+    // It reads the DB as of its creation: later writes are not seen, and the
+    // files it reads stay on disk until it is destroyed. Files outside the
+    // bounds are never opened, and memory does not grow with the number of
+    // keys walked. Must not outlive the DB.
+    class Iterator
+    {
+    public:
+        void seek_to_first();
+        // first visible key >= key, but not below lower
+        void seek(int key);
+        bool valid() const;
+        void next();
+        int key() const;
+        const Value& value() const;
+
+    private:
+        friend class DB;
+        Iterator() = default;
+
+        std::shared_ptr<const Version> version;
+        std::vector<std::shared_ptr<SSTable>> tables; // from the table cache, kept open while iterating
+        std::unique_ptr<MergingIterator> merged;
+        std::vector<Fragment> fragments;
+        int lower = INT32_MIN, upper = INT32_MAX;
+        uint64_t snapshot = UINT64_MAX; // versions at or above it are skipped
+        bool has_current = false;
+        int current_key = 0;
+        Value current_value;
+
+        void find_visible();
+    };
 
     Value get(int key);
-    void put(int key, Value val);
+    Value get(const ReadOptions& options, int key);
+    // Values for keys in input order. The keys are looked up in sorted order,
+    // so each SSTable is opened once per call and keys in the same block
+    // share its read.
+    std::vector<Value> multi_get(const std::vector<int>& keys);
+    std::vector<Value> multi_get(const ReadOptions& options, const std::vector<int>& keys);
+    // put, del and write return false when the write was not applied: its
+    // log record could not be written, or an earlier failure stopped the DB
+    bool put(int key, Value val);
+    // scan() and scan(min, max) collect an Iterator's values; max is exclusive.
+    // With more than one scan thread the range is split at file boundaries
+    // and the parts are merged in parallel from one consistent view.
     std::vector<Value> scan();
     std::vector<Value> scan(int min_key, int max_key);
-    void del(int key);
-    void del(int min_key, int max_key);
+    std::vector<Value> scan(const ReadOptions& options, int min_key, int max_key);
+    std::unique_ptr<Iterator> new_iterator(int lower = INT32_MIN, int upper = INT32_MAX);
+    std::unique_ptr<Iterator> new_iterator(const ReadOptions& options,
+        int lower = INT32_MIN, int upper = INT32_MAX);
+    // Pins the current state for reads through ReadOptions; must be released
+    // before the DB is destroyed.
+    const Snapshot* get_snapshot();
+    void release_snapshot(const Snapshot* snapshot);
+    bool del(int key);
+    bool del(int min_key, int max_key);
+    // Applies every op of the batch atomically: readers and recovery see all
+    // of it or none, and it pays for one lock, one log record and one flush check.
+    bool write(const WriteBatch& batch);
     size_t size();
 
+    // A directory opens (or creates) a persistent DB there: the MANIFEST is
+    // replayed to find the SSTables, then any WAL is replayed. Anything else
+    // is read as a CSV data file. Call before the first write.
     db_status open(std::string & fname);
     bool close();
 
@@ -49,29 +163,148 @@ public:
     std::vector<Value> execute_op(Operation op);
 
     void set_flush(int num);
+    // Flush once the MemTable's arena holds this many bytes instead of after
+    // set_flush ops; 0 goes back to counting ops.
+    void set_write_buffer_size(size_t bytes);
+    void set_max_immutable(int num);
+    void set_compaction_threads(int num);
+    void set_scan_threads(int num);
+    // Turning the log on replays the logs left in SSTables/ by an earlier run,
+    // so do it before the first write.
+    void set_wal(wal_mode mode, int sync_interval_ms = 100);
     void set_level_size(int num);
     void set_level_size_multi(int num);
+    // Measure levels in bytes on disk instead of entries: level 0 is
+    // compacted once it holds this many and each level below holds
+    // set_level_size_multi times more. 0 goes back to counting entries.
+    void set_level_bytes(uint64_t bytes);
+    // Derive the targets of the levels between 0 and the last from the last
+    // level's actual size, so they hold about 1/(multi-1) of the data
+    // instead of what a full last level would need.
+    void set_dynamic_level_bytes(bool enable);
+    std::vector<LevelStats> get_level_stats();
+    // Codec for the data blocks of new tables by level: per_level[i] for
+    // level i, the last entry for every level below. Empty (the default)
+    // stores every block plain; existing tables keep theirs until compacted.
+    void set_compression(const std::vector<table_format::Compression>& per_level);
+    // Shared by every DB in the process.
+    const CompressionStats& get_compression_stats() const;
+    void set_compaction_policy(CompactionPolicy::Kind kind);
+    void set_table_cache_size(int num);
+    void set_table_cache_memory(size_t bytes);
+    void set_mmap(bool enable);
+    void set_bloom_bits(int bits_per_key);
+    const FilterStats& get_filter_stats() const;
+    // Shared by every DB in the process; holds the blocks and filters of
+    // tables read without mmap and the decoded compressed blocks of mapped ones.
+    void set_block_cache_size(size_t bytes);
+    const BlockCacheStats& get_block_cache_stats() const;
 
 private:
+    // The MemTables and files reads go through. Replaced under the lock
+    // whenever one of them changes and loaded by readers without it; a reader
+    // holding one keeps its MemTables in memory and its files on disk.
+    struct ReadState {
+        std::shared_ptr<MemTable> active;
+        std::vector<std::shared_ptr<MemTable>> immutable; // newest first
+        std::shared_ptr<const Version> version;
+    };
+    // What a reader needs to see the DB as of one moment.
+    struct ReadView {
+        std::shared_ptr<const ReadState> state;
+        uint64_t seq; // reads see writes below it
+    };
+    // One caller of write() or flush() waiting in the writer queue.
+    struct Writer {
+        const WriteBatch* batch = nullptr; // nullptr for a MemTable switch, which never joins a group
+        bool done = false;       // committed by another writer's group
+        bool ok = true;          // false when that group was not applied
+        std::condition_variable cv;
+    };
+    void enter_writers(Writer& w, std::unique_lock<std::mutex>& lock);
+    void leave_writers();
+    ReadView read_view(const ReadOptions& options);
+    uint64_t read_seq(const ReadOptions& options) const;
+    std::shared_ptr<const ReadState> load_read_state() const;
+    void install_read_state();
+    std::unique_ptr<Iterator> new_iterator(const ReadView& view, int lower, int upper);
+    std::vector<Value> scan_range(const ReadOptions& options, int min_key, int max_key);
+
     std::fstream file;
     std::unordered_map<int, Value> table;
-    MemTable mmt;
+    std::shared_ptr<MemTable> mmt;
+    std::deque<std::shared_ptr<MemTable>> imm; // waiting to be flushed, oldest first
+    std::shared_ptr<LogWriter> log;                  // log of mmt, nullptr until the WAL is enabled
+    std::deque<std::shared_ptr<LogWriter>> imm_logs; // log of each immutable MemTable, may be nullptr
+    std::unique_ptr<LogWriter> manifest; // version edits, only for a DB opened on a directory
+    TableCache table_cache;
     size_t value_dimensions = 0;
+
+    // guards everything below; background threads drop it while writing files
+    std::mutex mutex;
+    std::shared_ptr<const ReadState> read_state; // swapped with std::atomic_store
+    std::deque<Writer*> writers; // the front one leads the next write group
+    std::condition_variable bg_cv;         // wakes the flush thread
+    std::condition_variable done_cv;       // an immutable MemTable was flushed
+    std::condition_variable compaction_cv; // wakes the compaction workers
+    std::condition_variable wal_cv;        // wakes the interval syncer early
+    std::thread flush_thread;
+    std::thread wal_sync_thread;
+    std::vector<std::thread> compaction_workers;
+    int compaction_threads = 2;
+    std::atomic<int> scan_threads{1};
+    bool shutting_down = false;
+    // a log, table or MANIFEST write failed: writes are refused, files stop
+    // changing, and what was not flushed stays in imm (and its log) for the
+    // next open
+    bool bg_error = false;
     
     bool write_to_file();
-    bool flush_check();
-    void compact(int level);
-    std::string path_control(int level, int num);
-    int max_level = 0;
+    bool flush_check(std::unique_lock<std::mutex>& lock);
+    bool memtable_full() const;
+    void switch_memtable();
+    void flush_worker();
+    void set_bg_error(const std::string& message);
+    void wal_sync_worker();
+    bool sync_log(const std::shared_ptr<LogWriter>& writer, uint64_t offset);
+    void replay_logs();
+    db_status open_dir(const std::string& dir);
+    bool recover();
+    bool adopt_tables(std::map<uint64_t, std::shared_ptr<FileMeta>>& files);
+    bool write_manifest(const Version& version);
+    bool log_edit(VersionEdit& edit, const Version& next);
+    void apply_record(const char* data, size_t n);
+    std::string log_path(uint64_t num);
+    void compaction_worker(int id);
+    Compaction pick_compaction();
+    uint64_t level_size(int level) const;
+    double level_target(int level) const;
+    double level_score(int level) const;
+    table_format::Compression level_compression(int level) const;
+    void compact(const Compaction& c, std::unique_lock<std::mutex>& lock);
+    std::string path_control(int level, uint64_t num);
     int count = 0;
     int db_size = 0;
-    uint64_t seq = 0;
-    std::vector<std::vector<int>> sstables_file; // sstable file name
-    std::vector<int> levels_size; //each level's current size
+    uint64_t seq = 0; // next seq a write group hands out
+    std::atomic<uint64_t> visible_seq{0}; // every seq below it is in a MemTable
+    uint64_t next_file_number = 0; // never reused, so a path always names one file
+    std::shared_ptr<const Version> current; // files per level, replaced on every install
+    std::vector<bool> compacting;  // level has a compaction in flight
+    std::multiset<uint64_t> snapshots; // seq of every live Snapshot
+    std::atomic<bool> use_mmap{true};
+    int bloom_bits_per_key = 10; // 0 disables Bloom filters for new SSTables
     int flush_base = 10;
+    size_t write_buffer_size = 0;
+    int max_immutable = 1; // writers stall once this many MemTables wait for a flush
     int level_size_base = 20; // Basic level size
     int level_size_multi = 4;
-    const std::string basic_path = "SSTables/SSTable_";
+    uint64_t level_bytes_base = 0; // 0 measures levels in entries
+    bool dynamic_level_bytes = false;
+    std::vector<table_format::Compression> compression_per_level;
+    std::unique_ptr<CompactionPolicy> compaction_policy = CompactionPolicy::create(CompactionPolicy::TIERING);
+    std::atomic<wal_mode> wal{WAL_DISABLED}; // read by writers after they drop the lock
+    int wal_sync_interval_ms = 100;
+    std::string db_dir = "SSTables";
 };
 
 }   // namespace templatedb
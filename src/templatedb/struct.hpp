@@ -2,17 +2,136 @@
 #pragma once
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <initializer_list>
 
 namespace templatedb {
 
+// The ints of a Value. Up to INLINE of them are stored inside the object,
+// so the usual small values (the workloads use 3 dimensions) are copied
+// around without a heap allocation; longer ones spill to the heap. Offers
+// the part of std::vector's interface the code base uses.
+class Items {
+public:
+    static const uint32_t INLINE = 4;
+
+    Items() {}
+    Items(std::initializer_list<int> init) { assign(init.begin(), init.size()); }
+    Items(const std::vector<int>& v) { assign(v.data(), v.size()); }
+    Items(const Items& other) { assign(other.data(), other.size()); }
+    Items(Items&& other) noexcept { take(other); }
+    ~Items() { release(); }
+
+    Items& operator=(const Items& other)
+    {
+        if (this != &other) assign(other.data(), other.size());
+        return *this;
+    }
+    Items& operator=(Items&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    int* data() { return cap > INLINE ? heap : buf; }
+    const int* data() const { return cap > INLINE ? heap : buf; }
+    int& operator[](size_t i) { return data()[i]; }
+    int operator[](size_t i) const { return data()[i]; }
+    int* begin() { return data(); }
+    int* end() { return data() + count; }
+    const int* begin() const { return data(); }
+    const int* end() const { return data() + count; }
+    int back() const { return data()[count - 1]; }
+
+    void reserve(size_t n)
+    {
+        if (n <= cap) return;
+        int* grown = new int[n];
+        std::memcpy(grown, data(), count * sizeof(int));
+        release();
+        heap = grown;
+        cap = static_cast<uint32_t>(n);
+    }
+    // new items are zeroed
+    void resize(size_t n)
+    {
+        reserve(n);
+        if (n > count) std::memset(data() + count, 0, (n - count) * sizeof(int));
+        count = static_cast<uint32_t>(n);
+    }
+    void push_back(int v)
+    {
+        if (count == cap) reserve(cap * 2);
+        data()[count++] = v;
+    }
+    void clear() { count = 0; }
+
+    std::vector<int> to_vector() const { return std::vector<int>(begin(), end()); }
+
+    bool operator==(const Items& other) const
+    {
+        return count == other.count && (count == 0 || std::memcmp(data(), other.data(), count * sizeof(int)) == 0);
+    }
+    bool operator!=(const Items& other) const { return !(*this == other); }
+    bool operator==(const std::vector<int>& other) const
+    {
+        return count == other.size() && (count == 0 || std::memcmp(data(), other.data(), count * sizeof(int)) == 0);
+    }
+    bool operator!=(const std::vector<int>& other) const { return !(*this == other); }
+
+private:
+    uint32_t count = 0;
+    uint32_t cap = INLINE; // > INLINE once the items live on the heap
+    union {
+        int buf[INLINE];
+        int* heap;
+    };
+
+    void assign(const int* src, size_t n)
+    {
+        count = 0;
+        reserve(n);
+        if (n > 0) std::memcpy(data(), src, n * sizeof(int));
+        count = static_cast<uint32_t>(n);
+    }
+    void take(Items& other)
+    {
+        count = other.count;
+        cap = other.cap;
+        if (cap > INLINE) {
+            heap = other.heap;
+        } else {
+            // only the live items, the rest of other.buf was never written
+            if (count > 0) std::memcpy(buf, other.buf, count * sizeof(int));
+        }
+        other.count = 0;
+        other.cap = INLINE;
+    }
+    void release()
+    {
+        if (cap > INLINE) delete[] heap;
+        cap = INLINE;
+    }
+};
+
+inline bool operator==(const std::vector<int>& a, const Items& b) { return b == a; }
+inline bool operator!=(const std::vector<int>& a, const Items& b) { return b != a; }
+
 class Value {
 public:
-    std::vector<int> items;
+    Items items;
     bool visible = true;
 
     Value() {}
     Value(bool _visible) : visible(_visible) {}
-    Value(std::vector<int> _items) : items(_items) {}
+    Value(std::initializer_list<int> _items) : items(_items) {}
+    Value(const std::vector<int>& _items) : items(_items) {}
+    Value(Items _items) : items(std::move(_items)) {}
 
     bool operator==(const Value& other) const {
         return visible == other.visible && items == other.items;
@@ -1,7 +1,11 @@
 #include "db.hpp"
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <thread>
+#include <chrono>
 
 using namespace templatedb;
 
@@ -61,6 +65,442 @@ int main() {
         std::cout << "\n";
     }
 
+    // Iterator: 按 key 顺序遍历, 结果与 scan(0, 5) 一致
+    std::cout<< "start iterator"<<"\n";
+    {
+        auto it = db.new_iterator();
+        size_t n = 0;
+        int prev = INT32_MIN;
+        for (it->seek(0); it->valid() && it->key() < 5; it->next(), ++n) {
+            assert(it->key() > prev);
+            prev = it->key();
+            assert(n < vals2.size() && it->value() == vals2[n]);
+        }
+        assert(n == vals2.size());
+    }
+
+    // multi_get: 结果按输入顺序, 重复的 key 各得一份, 不存在或被删除的 key 不可见
+    std::cout<< "start multi_get"<<"\n";
+    {
+        std::vector<int> keys = {7, 1, 7, 1000, 5, 0, 11, 4};
+        auto got = db.multi_get(keys);
+        assert(got.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            assert(got[i] == db.get(keys[i]));
+        }
+        assert(got[0].items == std::vector<int>({7, 7}) && got[2] == got[0]);
+        assert(!got[1].visible);      // point delete
+        assert(!got[3].visible);      // 不存在
+        assert(got[4].items == std::vector<int>({5, 5}));
+        assert(!got[6].visible && !got[7].visible); // range delete
+        assert(db.multi_get({}).empty());
+    }
+
+    // Snapshot: 之后的写入, flush 和 compaction 都不影响快照读
+    std::cout<< "start snapshot"<<"\n";
+    {
+        const Snapshot* snap = db.get_snapshot();
+        ReadOptions at_snap;
+        at_snap.snapshot = snap;
+        db.put(2, Value({22, 22}));
+        db.del(0, 3);
+        for (int i = 30; i < 60; ++i) {
+            db.put(i, Value({i, i}));
+        }
+        assert(!db.get(2).visible);
+        assert(db.get(at_snap, 2).items == std::vector<int>({2, 2}));
+        assert(db.get(at_snap, 0).visible);
+        assert(!db.get(at_snap, 1).visible);
+        assert(!db.get(at_snap, 40).visible);
+        auto old_vals = db.scan(at_snap, 0, 5);
+        assert(old_vals == vals2);
+        db.release_snapshot(snap);
+    }
+
+    // 空 DB 上的快照: 之后的写入对它都不可见
+    std::cout<< "start empty snapshot"<<"\n";
+    {
+        DB fresh;
+        const Snapshot* snap = fresh.get_snapshot();
+        ReadOptions at_snap;
+        at_snap.snapshot = snap;
+        fresh.put(1, Value({1, 1}));
+        assert(fresh.get(1).visible);
+        assert(!fresh.get(at_snap, 1).visible);
+        assert(!fresh.multi_get(at_snap, {1})[0].visible);
+        assert(fresh.scan(at_snap, 0, 5).empty());
+        fresh.release_snapshot(snap);
+    }
+
+    // Level bytes: 按磁盘字节数计算每层大小, 上层目标由最后一层推出
+    std::cout<< "start level bytes"<<"\n";
+    {
+        db.set_level_bytes(2048);
+        db.set_dynamic_level_bytes(true);
+        for (int i = 60; i < 200; ++i) {
+            db.put(i, Value({i, i}));
+        }
+        db.flush();
+        assert(db.get(150).items == std::vector<int>({150, 150}));
+        auto stats = db.get_level_stats();
+        uint64_t bytes = 0;
+        for (const auto& s : stats) bytes += s.bytes;
+        assert(bytes > 0 && stats.back().bytes > 0);
+    }
+
+    // Compression: 每层选择压缩方式 (L0 delta, 更深层 bit packing), 读出的数据不变
+    std::cout<< "start compression"<<"\n";
+    {
+        db.set_compression({table_format::DELTA_VARINT, table_format::BIT_PACKED});
+        for (int i = 200; i < 400; ++i) {
+            db.put(i, Value({i, i % 7, 65535}));
+        }
+        db.del(250);
+        db.flush();
+        assert(db.get(300).items == std::vector<int>({300, 300 % 7, 65535}));
+        assert(!db.get(250).visible);
+        assert(db.scan(200, 400).size() == 199);
+        const CompressionStats& stats = db.get_compression_stats();
+        assert(stats.stored_bytes < stats.raw_bytes);
+    }
+
+    // Compaction policy: tiering, leveling 和 lazy leveling 下, 覆盖写和删除后读到的结果一样
+    std::cout<< "start compaction policies"<<"\n";
+    for (auto kind : {CompactionPolicy::TIERING, CompactionPolicy::LEVELING, CompactionPolicy::LAZY_LEVELING}) {
+        std::string policy_dir = "SSTables/policy_" + std::to_string(kind);
+        std::filesystem::create_directory(policy_dir);
+        DB policy;
+        assert(policy.open(policy_dir) == OPEN);
+        policy.set_compaction_policy(kind);
+        policy.set_flush(8);
+        policy.set_level_size(16);
+        policy.set_level_size_multi(2);
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 100; ++i) policy.put(i, Value({i, round}));
+        }
+        policy.del(10);
+        policy.del(40, 50);
+        policy.flush();
+        // 等后台 compaction 把数据推到 L0 以下 (文件名 SSTable_<level>_<n>)
+        auto below_l0 = [&policy_dir] {
+            for (const auto& f : std::filesystem::directory_iterator(policy_dir)) {
+                std::string name = f.path().filename().string();
+                if (name.rfind("SSTable_", 0) == 0 && name.rfind("SSTable_0_", 0) != 0) return true;
+            }
+            return false;
+        };
+        for (int i = 0; i < 500 && !below_l0(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(below_l0());
+        for (int i = 0; i < 100; ++i) {
+            bool deleted = i == 10 || (i >= 40 && i < 50);
+            assert(deleted ? !policy.get(i).visible : policy.get(i).items == std::vector<int>({i, 2}));
+        }
+        assert(policy.scan(0, 100).size() == 89);
+    }
+
+    // 运行中从 tiering 切到 leveling: L1 里重叠的旧 run 都要并进输出, 否则较新的 run 会被输出遮住
+    std::cout<< "start policy switch"<<"\n";
+    {
+        std::string switch_dir = "SSTables/policy_switch";
+        std::filesystem::create_directory(switch_dir);
+        DB live;
+        assert(live.open(switch_dir) == OPEN);
+        live.set_flush(1000);
+        live.set_level_size(4);
+        live.set_level_size_multi(100);
+        // 等 L0 被 compact 掉, 返回 L1 的文件数
+        auto settle = [&live]() -> size_t {
+            for (int i = 0; i < 500; ++i) {
+                auto stats = live.get_level_stats();
+                if (stats[0].files == 0 && stats.size() > 1) return stats[1].files;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return 0;
+        };
+        for (int k : {0, 50, 95, 100}) live.put(k, Value({k, 1}));
+        live.flush();
+        assert(settle() == 1);              // L1: A [0, 100]
+        for (int k : {90, 95, 150, 200}) live.put(k, Value({k, 2}));
+        live.flush();
+        assert(settle() == 2);              // L1: A, 较新的 B [90, 200]
+        live.set_compaction_policy(CompactionPolicy::LEVELING);
+        for (int k : {10, 12, 15, 20}) live.put(k, Value({k, 3}));
+        live.flush();
+        assert(settle() > 0);               // [10, 20] 碰到 A, A 又碰到 B, 三者一起合并
+        assert(live.get(95).items == std::vector<int>({95, 2}));
+        assert(live.scan(95, 96)[0].items == std::vector<int>({95, 2}));
+        assert(live.get(0).items == std::vector<int>({0, 1}) && live.get(200).visible);
+    }
+
+    // 多线程 scan: 按文件最小 key 切成几段并行扫, 结果和单线程完全一样 (包括切分点上的 key 和 INT32_MAX)
+    std::cout<< "start scan threads"<<"\n";
+    {
+        std::string threads_dir = "SSTables/scan_threads";
+        std::filesystem::create_directory(threads_dir);
+        DB parted;
+        assert(parted.open(threads_dir) == OPEN);
+        parted.set_flush(16);
+        parted.set_level_size(32);
+        parted.set_level_size_multi(2);
+        std::vector<int> keys = {INT32_MIN, -1000, INT32_MAX - 1, INT32_MAX};
+        for (int i = 0; i < 400; ++i) keys.push_back(i * 7 % 400);
+        for (int round = 0; round < 2; ++round)
+            for (int k : keys) parted.put(k, Value({k, round}));
+        parted.del(100, 120);
+        parted.del(INT32_MAX - 1);
+        parted.flush();
+        for (int i = 0; i < 50; ++i) parted.put(i * 5, Value({i * 5, 2}));
+        parted.flush();
+        auto stats = parted.get_level_stats();
+        assert(stats.size() > 2 && stats[0].files + stats[1].files > 1);
+
+        // 切分点是各文件的最小 key, 每个 key 都当一次范围的上下界, 切分点也就都覆盖到了
+        std::vector<std::pair<int, int>> ranges = {{INT32_MIN, INT32_MAX}, {-1000, 0}, {100, 120},
+            {0, INT32_MAX}, {INT32_MAX - 1, INT32_MAX}, {50, 50}};
+        for (int k = 0; k < 400; ++k) ranges.push_back({k, k + 40});
+        parted.set_scan_threads(1);
+        std::vector<Value> whole = parted.scan();
+        std::vector<std::vector<Value>> single;
+        for (auto [lo, hi] : ranges) single.push_back(parted.scan(lo, hi));
+        assert(whole.size() == 2 + 400 - 20 + 4 + 1);  // [100, 120) 删掉后又写回 100, 105, 110, 115
+        assert(whole.back().items == std::vector<int>({INT32_MAX, 1}));
+        parted.set_scan_threads(4);
+        assert(parted.scan() == whole);
+        for (size_t i = 0; i < ranges.size(); ++i)
+            assert(parted.scan(ranges[i].first, ranges[i].second) == single[i]);
+    }
+
+    // Bloom filter: 不存在的 key 由 filter 直接排除, 结果不变; bits 设为 0 后新的 SSTable 不带 filter
+    std::cout<< "start bloom filter"<<"\n";
+    {
+        std::string bloom_dir = "SSTables/bloom";
+        std::filesystem::create_directory(bloom_dir);
+        DB filtered;
+        assert(filtered.open(bloom_dir) == OPEN);
+        filtered.set_flush(1000);
+        filtered.set_level_size(100000);
+        filtered.set_bloom_bits(10);
+        for (int i = 0; i < 1000; i += 2) filtered.put(i, Value({i, i}));
+        filtered.flush();
+        const FilterStats& stats = filtered.get_filter_stats();
+        uint64_t negatives = stats.negatives;
+        for (int i = 1; i < 1000; i += 2) assert(!filtered.get(i).visible);
+        for (int i = 0; i < 1000; i += 2) assert(filtered.get(i).items == std::vector<int>({i, i}));
+        assert(stats.negatives > negatives);
+        // 只落在没有 filter 的新文件里的 key, 不再查 filter
+        filtered.set_bloom_bits(0);
+        for (int i = 1000; i < 2000; i += 2) filtered.put(i, Value({i, i}));
+        filtered.flush();
+        uint64_t checks = stats.checks;
+        for (int i = 1001; i < 2000; i += 2) assert(!filtered.get(i).visible);
+        assert(filtered.get(1500).items == std::vector<int>({1500, 1500}));
+        assert(stats.checks == checks);
+    }
+
+    // Block cache: pread 模式下 get 缓存的 block, scan 和重新打开的同一文件都能命中
+    std::cout<< "start block cache"<<"\n";
+    {
+        std::string cache_dir = "SSTables/block_cache";
+        std::filesystem::create_directory(cache_dir);
+        DB cached;
+        assert(cached.open(cache_dir) == OPEN);
+        cached.set_mmap(false);
+        cached.set_flush(1000);
+        cached.set_level_size(100000);
+        for (int i = 0; i < 300; ++i) cached.put(i, Value({i, i}));
+        cached.flush();
+        for (int i = 300; i < 600; ++i) cached.put(i, Value({i, i}));
+        cached.flush();
+        for (int i = 0; i < 600; ++i) assert(cached.get(i).items == std::vector<int>({i, i}));
+        const BlockCacheStats& stats = cached.get_block_cache_stats();
+        uint64_t hits = stats.hits;
+        assert(cached.scan(0, 600).size() == 600);
+        assert(stats.hits > hits);
+        // 只留一个打开的表, 两个文件轮流读, 每次都重新打开
+        cached.set_table_cache_size(1);
+        hits = stats.hits;
+        for (int i = 0; i < 10; ++i) assert(cached.get(i % 2 ? 10 : 310).visible);
+        assert(stats.hits >= hits + 10);
+    }
+
+    // WAL: 未 flush 的写入在重启后从日志恢复
+    std::cout<< "start wal replay"<<"\n";
+    {
+        DB logged;
+        logged.set_flush(100);
+        logged.set_wal(WAL_SYNC_EVERY_WRITE);
+        logged.put(100, Value({100, 100}));
+        logged.put(101, Value({101, 101}));
+        logged.del(101);
+    }
+    {
+        DB replayed;
+        replayed.set_flush(100);
+        replayed.set_wal(WAL_SYNC_EVERY_WRITE);
+        assert(replayed.get(100).items == std::vector<int>({100, 100}));
+        assert(!replayed.get(101).visible);
+    }
+
+    // WriteBatch: 一批写入作为一条 WAL 记录, 重启后整体恢复
+    std::cout<< "start write batch"<<"\n";
+    {
+        DB batched;
+        batched.set_flush(100);
+        batched.set_wal(WAL_SYNC_EVERY_WRITE);
+        WriteBatch batch;
+        for (int i = 200; i < 210; ++i) batch.put(i, Value({i, i}));
+        batch.del(203);
+        batch.del(205, 208);
+        batch.put(206, Value({60, 60})); // 在 range delete 之后, 可见
+        assert(batch.count() == 13);
+        batched.write(batch);
+        assert(batched.get(200).visible && !batched.get(203).visible && !batched.get(205).visible);
+    }
+    {
+        DB replayed;
+        replayed.set_flush(100);
+        replayed.set_wal(WAL_SYNC_EVERY_WRITE);
+        assert(replayed.get(209).items == std::vector<int>({209, 209}));
+        assert(!replayed.get(203).visible);
+        assert(!replayed.get(207).visible);
+        assert(replayed.get(206).items == std::vector<int>({60, 60}));
+    }
+
+    // 并发读写 + group commit: 读者看到的每个 batch 都是完整的, 重启后所有已确认的写入都还在
+    std::cout<< "start group commit"<<"\n";
+    std::string group_dir = "SSTables/group";
+    std::filesystem::create_directory(group_dir);
+    {
+        DB shared;
+        assert(shared.open(group_dir) == OPEN);
+        shared.set_flush(1000);
+        shared.set_wal(WAL_SYNC_EVERY_WRITE);
+        std::atomic<int> running{4};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&shared, &running, t] {
+                for (int i = 0; i < 500; ++i) {
+                    int k = 2 * (t * 500 + i);
+                    WriteBatch batch;
+                    batch.put(k, Value({k, t}));
+                    batch.put(k + 1, Value({k + 1, t}));
+                    assert(shared.write(batch));
+                }
+                running--;
+            });
+        }
+        std::thread reader([&shared, &running] {
+            for (int k = 0; running > 0; k = (k + 2) % 4000) {
+                auto pair = shared.multi_get({k, k + 1});
+                assert(pair[0].visible == pair[1].visible);
+            }
+        });
+        for (auto& th : threads) th.join();
+        reader.join();
+        assert(shared.get(3999).items == std::vector<int>({3999, 3}));
+    }
+    {
+        DB replayed;
+        assert(replayed.open(group_dir) == OPEN);
+        replayed.set_wal(WAL_SYNC_EVERY_WRITE);
+        for (int k = 0; k < 4000; ++k) assert(replayed.get(k).items == std::vector<int>({k, k / 1000}));
+    }
+
+    // 并发写入 + 调整 write buffer: 切换 MemTable 时不能丢失已确认的写入
+    std::cout<< "start concurrent setter"<<"\n";
+    {
+        std::string setter_dir = "SSTables/setter";
+        std::filesystem::create_directory(setter_dir);
+        DB shared;
+        assert(shared.open(setter_dir) == OPEN);
+        shared.set_wal(WAL_SYNC_EVERY_WRITE); // leader 在 sync 时不持锁, 窗口更大
+        std::atomic<int> running{4};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&shared, &running, t] {
+                for (int i = 0; i < 2000; ++i) shared.put(t * 2000 + i, Value({i, t}));
+                running--;
+            });
+        }
+        for (int i = 0; running > 0; ++i) shared.set_write_buffer_size(i % 2 ? 64 : 1 << 20);
+        for (auto& th : threads) th.join();
+        for (int k = 0; k < 8000; ++k) assert(shared.get(k).items == std::vector<int>({k % 2000, k / 2000}));
+    }
+
+    // MANIFEST: 以目录打开的 DB 重启后找回自己的 SSTable, seq 接着上次继续
+    std::cout<< "start reopen"<<"\n";
+    std::string dir = "SSTables/reopen";
+    std::filesystem::create_directory(dir);
+    {
+        DB persisted;
+        assert(persisted.open(dir) == OPEN);
+        persisted.set_flush(5);
+        for (int i = 0; i < 30; ++i) {
+            persisted.put(i, Value({i, i}));
+        }
+        persisted.del(3);
+    }
+    {
+        DB reopened;
+        assert(reopened.open(dir) == OPEN);
+        assert(reopened.get(7).items == std::vector<int>({7, 7}));
+        assert(!reopened.get(3).visible);
+        reopened.put(7, Value({70, 70}));
+        reopened.flush();
+        assert(reopened.get(7).items == std::vector<int>({70, 70}));
+    }
+
+    // flush 写文件失败: 不装入新版本, 数据留在内存里, flush() 也不会卡住, 之后的写入返回 false
+    std::cout<< "start flush error"<<"\n";
+    {
+        std::string broken_dir = "SSTables/broken";
+        std::filesystem::create_directory(broken_dir);
+        DB broken;
+        assert(broken.open(broken_dir) == OPEN);
+        broken.put(1, Value({1, 1}));
+        std::filesystem::remove_all(broken_dir);
+        broken.flush();
+        assert(broken.get(1).items == std::vector<int>({1, 1}));
+        assert(!broken.put(2, Value({2, 2}))); // 出错后拒绝写入
+        assert(!broken.get(2).visible);
+    }
+
+    // 没有 MANIFEST 的旧目录: 打开时接管已有的 SSTable, 而不是当作孤儿删掉
+    std::cout<< "start legacy dir"<<"\n";
+    std::string legacy_dir = "SSTables/legacy";
+    std::filesystem::create_directory(legacy_dir);
+    {
+        // 旧的文本格式: 头部, 3 个定长 offset, entries (seq tomb key items), tombs, key 索引
+        std::string header = "2\n1\n1\n9\n0\n";
+        std::string first = "0 0 1 10 10\n", second = "1 0 9 90 90\n", tomb = "2 5 8\n";
+        size_t entry_offset = header.size() + 3 * 11;
+        size_t tomb_offset = entry_offset + first.size() + second.size();
+        auto pad = [](size_t v) {
+            std::string s = std::to_string(v);
+            return s + std::string(10 - s.size(), ' ') + "\n";
+        };
+        std::ofstream out(legacy_dir + "/SSTable_0_0.data", std::ios::binary);
+        out << header << pad(entry_offset) << pad(tomb_offset) << pad(tomb_offset + tomb.size())
+            << first << second << tomb
+            << "1 " << entry_offset << "\n9 " << entry_offset + first.size() << "\n";
+    }
+    {
+        DB legacy;
+        assert(legacy.open(legacy_dir) == OPEN);
+        assert(legacy.get(1).items == std::vector<int>({10, 10}));
+        assert(legacy.get(9).items == std::vector<int>({90, 90}));
+        legacy.put(6, Value({60, 60})); // seq 接在旧表之后, 不被旧的 range delete 覆盖
+        assert(legacy.get(6).visible);
+    }
+    {
+        DB reopened;
+        assert(reopened.open(legacy_dir) == OPEN);
+        assert(reopened.get(1).items == std::vector<int>({10, 10}));
+        assert(reopened.get(6).items == std::vector<int>({60, 60}));
+    }
+
     std::cout << "[PASS] All assertions passed.\n";
     return 0;
 }